@@ -0,0 +1,16 @@
+#pragma once
+#include <glm/glm.hpp>
+
+/// <summary>
+/// Axis aligned bounding box, plain data without any GL objects so it is cheap to copy and store next to other culling data
+/// </summary>
+struct AABB {
+	glm::vec3 min, max;
+
+	/// <summary>
+	/// Corner nr, bit 0 selects max x, bit 1 max y and bit 2 max z
+	/// </summary>
+	glm::vec3 getCorner(unsigned int nr) const {
+		return glm::vec3{ nr & 1 ? max.x : min.x, nr & 2 ? max.y : min.y, nr & 4 ? max.z : min.z };
+	}
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <glad/glad.h>
+#include <vector>
+#include "ChunkIndexBuffer.h"
+#include "WorkerPool.h"
+#include "ScratchArena.h"
+
+/// <summary>
+/// Index sets for every lod of one chunk, built as a right triangulated irregular network (RTIN) over the chunk's own heights.
+/// Smooth areas get few large triangles while rough areas stay fine. Each patch is triangulated on its own, and every patch side
+/// keeps exactly the vertices of the regular lod grid, so patches, chunks and regular chunks of the same lod meet without cracks.
+/// Chunks of different lods are joined by skirts
+/// </summary>
+class AdaptiveIndexBuffer {
+public:
+	using Range = ChunkIndexBuffer::Range;
+
+	AdaptiveIndexBuffer() = default;
+	/// <summary>
+	/// Triangulate lod 1, 2, 4 .. maxLod. Lod 2 and coarser may deviate as much from the full resolution heights as the regular lod grid does,
+	/// lod 1 half of that of lod 2
+	/// </summary>
+	/// <param name="heights">full resolution heights without skirts, row by row</param>
+	/// <param name="_nrVertices">number of vertices per chunk side excluding skirts, (nrVertices - 1) / patchesPerSide must be a power of two</param>
+	/// <param name="lodErrors">max error of the regular grid of lod 1, 2, 4 .. maxLod</param>
+	/// <param name="pool">computes the errors of the patches in parallel if given, the indices come out the same. The scratch memory is taken
+	/// from the arena of the calling thread</param>
+	AdaptiveIndexBuffer(const float* heights, unsigned int _nrVertices, unsigned int _maxLod, unsigned int _patchesPerSide, const float* lodErrors,
+		WorkerPool* pool = nullptr);
+
+	/// <summary>
+	/// Upload the index sets to VRAM, the indices are released from RAM
+	/// </summary>
+	void bake();
+
+	/// <summary>
+	/// Remove buffer object from VRAM
+	/// </summary>
+	void deleteBuffer();
+
+	/// <summary>
+	/// True once triangulated
+	/// </summary>
+	bool isBuilt() const {
+		return !lods.empty();
+	}
+
+	bool isBaked() const {
+		return baked;
+	}
+
+	/// <summary>
+	/// Every patch and the skirts
+	/// </summary>
+	const Range& getRange(unsigned int lod) const {
+		return lods[ChunkIndexBuffer::lodLevel(lod)].all;
+	}
+
+	/// <summary>
+	/// Triangles of patch, patches are numbered row by row and follow each other in the same order
+	/// </summary>
+	const Range& getPatchRange(unsigned int lod, unsigned int patch) const {
+		return lods[ChunkIndexBuffer::lodLevel(lod)].patches[patch];
+	}
+
+	/// <summary>
+	/// Skirts, together with all patches this is the full lod
+	/// </summary>
+	const Range& getBorderRange(unsigned int lod) const {
+		return lods[ChunkIndexBuffer::lodLevel(lod)].skirts;
+	}
+
+	unsigned int getSkirtTriangles(unsigned int lod) const {
+		return lods[ChunkIndexBuffer::lodLevel(lod)].skirts.count / 3;
+	}
+
+	unsigned int getEBO() const {
+		return EBO;
+	}
+
+private:
+	struct LodSet {
+		Range all;
+		std::vector<Range> patches;
+		Range skirts;
+	};
+
+	/// <summary>
+	/// Corners a, b of the hypotenuse of every triangle in the patch hierarchy, coarsest first.
+	/// The hierarchy only depends on the patch size and is shared by all chunks
+	/// </summary>
+	static const std::vector<unsigned char>& triangleCoordinates(unsigned int patchSpan);
+
+	/// <summary>
+	/// Max error of every triangle in patch px, pz against the full resolution heights, indexed by hypotenuse midpoint
+	/// </summary>
+	/// <param name="errors">(patchSpan + 1)^2 errors of the patch</param>
+	void computeErrors(const float* heights, unsigned int px, unsigned int pz, float* errors) const;
+
+	/// <summary>
+	/// Adapt the errors of one patch to a lod: hypotenuses on the patch sides longer than lod are always split and shorter ones never,
+	/// then make the errors never grow from a triangle to its children so a split midpoint always has both its triangles
+	/// </summary>
+	/// <param name="fixed">(patchSpan + 1)^2 flags to mark the side midpoints in</param>
+	void constrainErrors(float* errors, unsigned char* fixed, unsigned int lod) const;
+
+	/// <summary>
+	/// Add the triangle a, b, c or, if its hypotenuse midpoint error is above maxError, its two children
+	/// </summary>
+	void addTriangle(const float* errors, float maxError, unsigned int px, unsigned int pz,
+		unsigned int ax, unsigned int ay, unsigned int bx, unsigned int by, unsigned int cx, unsigned int cy);
+
+	/// <summary>
+	/// Add triangle a, b, c of the skirted grid counter clockwise seen from above, same as ChunkIndexBuffer
+	/// </summary>
+	void addIndices(unsigned int a, unsigned int b, unsigned int c);
+
+	/// <summary>
+	/// Skirt wall along every side sampled every lod steps
+	/// </summary>
+	void addSkirts(unsigned int lod);
+
+	unsigned int nrVertices; //vertices per side in the full resolution grid including skirts
+	unsigned int patchesPerSide;
+	unsigned int patchSpan; //cells per patch side
+
+	std::vector<unsigned int> indices;
+	std::vector<LodSet> lods;
+
+	unsigned int EBO;
+	bool baked = false;
+};
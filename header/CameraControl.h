@@ -50,6 +50,11 @@ public:
 
 	glm::vec3 getCameraPosition() const;
 
+	/// <summary>
+	/// Move the camera to pos, rotation is unchanged
+	/// </summary>
+	void setCameraPosition(const glm::vec3& pos);
+
 private:
 	/// <summary>
 	/// Recompute front, up and right vectors
@@ -0,0 +1,163 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cassert>
+#include "Mesh.h"
+#include "Shader.h"
+#include "ChunkCuller.h"
+#include "ChunkIndexBuffer.h"
+
+/// <summary>
+/// Continuous distance dependent lod (CDLOD) renderer for the chunk grid. Every chunk is the root of a quadtree whose nodes
+/// are all drawn with one shared grid patch, instanced once per selected node in a single draw call. A node is selected when the camera
+/// is within the distance range of its lod, and vertex.vert morphs the vertices of each node towards the next coarser lod before
+/// the range ends, so lods change without popping and neighboring nodes meet without cracks.
+/// Heights and normals are read in the vertex shader from a texture array holding the packed vertices of every chunk, one layer per chunk,
+/// so no chunk needs a mesh of its own. A layer is the full resolution grid, 163 x 163 texels of 8 bytes or about 210 KB, and is the only copy
+/// of the vertices of its chunk while CDLOD is used, see readChunk. Chunks quantize their heights differently, so nodes on chunk sides hang skirts there as the chunk meshes do
+/// </summary>
+class CdlodTerrain {
+public:
+	/// <summary>
+	/// Quadtree data of one chunk
+	/// </summary>
+	struct ChunkNodes {
+		glm::vec2 origin; //x, z of the first vertex
+		float minHeight, maxHeight; //height range the packed heights are quantized in
+		unsigned int layer; //texture layer holding the packed vertices
+		const float* nodeMinHeights; //height range of every node, indexed by nodeIndex
+		const float* nodeMaxHeights;
+		unsigned int minLevel; //finest level the chunk has vertices for, nodes are not refined below it
+	};
+
+	static constexpr unsigned int levels = 5; //lod 1, 2, 4, 8, 16
+	static constexpr unsigned int flatLayer = 0; //layer of the shared flat chunk
+
+	CdlodTerrain() = default;
+	/// <summary>
+	/// Create the grid patch and a height texture for maxChunks chunks
+	/// </summary>
+	/// <param name="_nrVertices">number of vertices per chunk side excluding skirts, (nrVertices - 1) must be divisible by 16 * 2</param>
+	/// <param name="maxChunks">most chunks alive at the same time, flat chunks excluded</param>
+	/// <param name="flatVertices">packed vertices shared by every flat chunk</param>
+	CdlodTerrain(unsigned int _nrVertices, float _spacing, unsigned int maxChunks, const std::vector<TerrainVertex>& flatVertices);
+
+	/// <summary>
+	/// Remove buffer objects and the height texture from VRAM
+	/// </summary>
+	void deleteBuffers();
+
+	/// <summary>
+	/// Copy the packed vertices (with skirts) of a chunk to a free texture layer and return the layer.
+	/// maxChunks must cover every chunk alive at the same time, flatLayer is returned if no layer is free and the chunk is not uploaded
+	/// </summary>
+	unsigned int uploadChunk(const TerrainVertex* vertices);
+
+	/// <summary>
+	/// Read the packed vertices of the chunk in layer back from VRAM
+	/// </summary>
+	void readChunk(unsigned int layer, TerrainVertex* vertices) const;
+
+	/// <summary>
+	/// Free the layer of a chunk that is deleted
+	/// </summary>
+	void releaseChunk(unsigned int layer);
+
+	/// <summary>
+	/// Set the distance ranges of every lod so a cell of the grid patch covers about cellPixels pixels on screen
+	/// </summary>
+	/// <param name="pixelsPerUnit">screen pixels covered by one world unit at distance 1</param>
+	void setRanges(float pixelsPerUnit, float cellPixels);
+
+	/// <summary>
+	/// Distance range of level set by setRanges, nodes within the range of the next finer level are split
+	/// </summary>
+	float levelRange(unsigned int level, float pixelsPerUnit, float cellPixels) const;
+
+	/// <summary>
+	/// Start selecting nodes for a new frame
+	/// </summary>
+	void clear() {
+		fullNodes.clear();
+		quarterNodes.clear();
+	}
+
+	/// <summary>
+	/// Select the nodes of one chunk seen from camPos, nodes outside the frustum of culler are dropped
+	/// </summary>
+	void selectNodes(const ChunkNodes& chunk, const glm::vec3& camPos, const ChunkCuller& culler);
+
+	/// <summary>
+	/// Draw every selected node, returns the number of triangles drawn
+	/// </summary>
+	unsigned int draw(const Shader& shader, const glm::vec3& camPos);
+
+	unsigned int getDrawCalls() const {
+		return drawCalls;
+	}
+
+	unsigned int getNodesSelected() const {
+		return static_cast<unsigned int>(fullNodes.size() + quarterNodes.size());
+	}
+
+	/// <summary>
+	/// Index of node x, z of level in the per chunk node arrays, the root comes first and the finest level last
+	/// </summary>
+	static unsigned int nodeIndex(unsigned int level, unsigned int x, unsigned int z) {
+		unsigned int side = 1u << (levels - 1 - level);
+		return ((side * side - 1) / 3) + x + side * z;
+	}
+
+	/// <summary>
+	/// Number of entries in the per chunk node arrays
+	/// </summary>
+	static unsigned int nodeCount() {
+		return nodeIndex(0, 0, 0) + (1u << (levels - 1)) * (1u << (levels - 1));
+	}
+
+private:
+	/// <summary>
+	/// Per instance data, matches the node attributes of vertex.vert
+	/// </summary>
+	struct Instance {
+		float originX, originZ, minHeight, maxHeight;
+		int gridX, gridZ, level, layer; //first grid coordinate of the node in the chunk
+	};
+
+	/// <summary>
+	/// Select node x, z of level or its children. Returns false if the node is beyond the range of its level,
+	/// the parent then draws that part at its own lod
+	/// </summary>
+	bool selectNode(const ChunkNodes& chunk, unsigned int level, unsigned int x, unsigned int z, const glm::vec3& camPos, const ChunkCuller& culler);
+
+	AABB nodeBounds(const ChunkNodes& chunk, unsigned int level, unsigned int x, unsigned int z) const;
+
+	/// <summary>
+	/// Add the cells in the first cells x cells corner of the grid patch, except those in the first skip x skip corner
+	/// </summary>
+	void addCells(unsigned int cells, unsigned int skip);
+
+	/// <summary>
+	/// Add the two triangles of a quad given counter clockwise from its top left corner
+	/// </summary>
+	void addCell(unsigned int i1, unsigned int i2, unsigned int i3, unsigned int i4);
+
+	unsigned int nrVertices; //vertices per chunk side excluding skirts
+	unsigned int patchCells; //cells per grid patch side
+	float spacing;
+
+	float ranges[levels]; //a node is drawn at level when its bounds are within this distance, and further refined within ranges[level - 1]
+	glm::vec2 morphRanges[levels]; //distance where morphing to the next coarser lod starts and ends
+
+	unsigned int VAO = 0, VBO = 0, EBO = 0, instanceVBO = 0;
+	using Range = ChunkIndexBuffer::Range;
+	Range full, quarter; //whole patch and its first quarter, each with skirts
+	std::vector<unsigned int> indices;
+	std::vector<Instance> fullNodes, quarterNodes;
+	unsigned int drawCalls = 0;
+
+	unsigned int heightTexture = 0;
+	unsigned int readFBO = 0; //reads a layer back, integer textures can not be read with glGetTexImage one layer at a time
+	std::vector<unsigned int> freeLayers;
+};
@@ -0,0 +1,265 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "AABB.h"
+#include "CameraPlane.h"
+#include "OcclusionBuffer.h"
+
+/// <summary>
+/// Hot per chunk data for culling and lod selection, kept apart from the chunk objects.
+/// Chunk bounds are the leaves of a quadtree over the chunk grid whose nodes hold the merged bounds of their children.
+/// Each level is stored as structure of arrays in morton order so the four children of a node are contiguous and tested
+/// against the camera planes together with SSE. Planes a node is fully inside are not tested again below it,
+/// and subtrees inside all planes are added without tests, so culling cost follows the number of visible nodes.
+/// Nodes remember the plane that rejected them and test it first next frame, and the whole pass is skipped
+/// while the planes and the tree are unchanged. Optionally the chunks in the frustum are then tested nearest first
+/// against a coarse depth buffer of the nearer chunks, so chunks behind ridges are dropped.
+/// The visible chunks get their lod selected every frame, and the patches of chunks crossing the frustum are culled one by one
+/// </summary>
+class ChunkCuller {
+public:
+	struct DrawItem {
+		unsigned int slot; //slot of the chunk, see setChunk
+		int lod;
+		uint32_t patchMask; //bit p set if patch p is visible
+	};
+
+	/// <summary>
+	/// Culling data of one chunk
+	/// </summary>
+	struct ChunkData {
+		AABB bounds;
+		const float* lodErrors; //max error of lod 1, 2, 4, 8, 16
+		const float* occluderHeights; //lowest height of each cell in an occluderCells x occluderCells grid over the chunk, row by row
+		const float* patchMinHeights; //height range of each patch, row by row
+		const float* patchMaxHeights;
+		int minLod = 1; //finest lod the chunk has vertices for, it is never selected finer
+	};
+
+	struct LodParameters {
+		float pixelsPerUnit; //screen pixels covered by one world unit at distance 1
+		float tolerance; //max screen space error in pixels
+		float hysteresis; //part of the tolerance a chunk must be below before it gets coarser
+		float minDistance; //distance used for chunks the camera is inside
+		int fixedLod = 0; //draw every chunk at this lod when > 0, the selection and its hysteresis go on underneath
+	};
+
+	ChunkCuller() = default;
+	/// <summary>
+	/// Create culling data for a gridSize x gridSize grid of chunks
+	/// </summary>
+	/// <param name="_maxLod">coarsest lod, new chunks start at this lod</param>
+	/// <param name="_occluderCells">occluder cells per chunk side</param>
+	/// <param name="_patchesPerSide">patches per chunk side</param>
+	ChunkCuller(unsigned int _gridSize, int _maxLod, unsigned int _occluderCells, unsigned int _patchesPerSide);
+
+	/// <summary>
+	/// Store the culling data of the chunk placed in slot, slot col + gridSize * row is a leaf next to the slots of the neighboring cols and rows
+	/// counted from the origin, see setOrigin
+	/// </summary>
+	void setChunk(unsigned int slot, const ChunkData& chunk);
+
+	/// <summary>
+	/// Make slot the first leaf of the tree, the slots after it wrap around the grid. Slots keep their data and their leaves move,
+	/// so chunks placed in slots by their coordinate wrapped around the grid stay neighboring leaves while they are within gridSize of the origin
+	/// </summary>
+	void setOrigin(unsigned int slot);
+
+	/// <summary>
+	/// Cull the patches of chunks crossing the frustum, on by default
+	/// </summary>
+	void usePatchCulling(bool use) {
+		if (use != patchCulling)
+			culledValid = false;
+		patchCulling = use;
+	}
+
+	/// <summary>
+	/// Empty slot when its chunk is deleted, the leaf is then never visible
+	/// </summary>
+	void removeChunk(unsigned int slot);
+
+	/// <summary>
+	/// Planes to cull against, no planes disables culling
+	/// </summary>
+	void setPlanes(const std::vector<CameraPlane>& cameraPlanes);
+
+	/// <summary>
+	/// True if bounds are inside or crossing the planes, ie. not rejected by frustum culling
+	/// </summary>
+	bool inFrustum(const AABB& bounds) const;
+
+	/// <summary>
+	/// Use last frame's rejecting planes and culling result, on by default. Off gives the plane test count of a cold pass
+	/// </summary>
+	void useTemporalCoherence(bool use) {
+		temporalCoherence = use;
+	}
+
+	/// <summary>
+	/// Cull chunks hidden behind nearer chunks as seen through viewProjection
+	/// </summary>
+	void setOcclusion(bool use, const glm::mat4& _viewProjection);
+
+	/// <summary>
+	/// Refit the tree where chunks changed, cull it and select the lod of the visible chunks
+	/// </summary>
+	void update(const glm::vec3& camPos, const LodParameters& params);
+
+	/// <summary>
+	/// Visible chunks and their lod
+	/// </summary>
+	const std::vector<DrawItem>& getDrawList() const {
+		return drawList;
+	}
+
+	/// <summary>
+	/// Lod of slot this frame, culled chunks get their lod selected on demand so visible neighbors can stitch to them
+	/// </summary>
+	int getLod(unsigned int slot);
+
+	/// <summary>
+	/// Tree nodes tested against the planes in the last update, empty nodes outside the grid are not counted
+	/// </summary>
+	unsigned int getNodesTested() const {
+		return nodesTested;
+	}
+
+	/// <summary>
+	/// Node and patch against plane tests in the last update. Empty lanes of a SIMD batch and boxes already rejected by an earlier plane are not counted
+	/// </summary>
+	unsigned int getPlaneTests() const {
+		return planeTests;
+	}
+
+	/// <summary>
+	/// Chunks inside the frustum that were rejected by occlusion culling in the last culling pass
+	/// </summary>
+	unsigned int getOccludedChunks() const {
+		return occludedChunks;
+	}
+
+	/// <summary>
+	/// Patch mask with every patch visible
+	/// </summary>
+	uint32_t allPatches() const {
+		unsigned int nrPatches = patchesPerSide * patchesPerSide;
+		return nrPatches >= 32 ? ~0u : (1u << nrPatches) - 1;
+	}
+
+	/// <summary>
+	/// Patches of visible chunks that were culled in the last culling pass
+	/// </summary>
+	unsigned int getCulledPatches() const {
+		return culledPatches;
+	}
+
+	/// <summary>
+	/// True if the last update reused the previous culling result
+	/// </summary>
+	bool reusedCulling() const {
+		return reused;
+	}
+
+private:
+	struct Plane {
+		float nx, ny, nz, d; //outside where n * p + d > 0
+	};
+
+	/// <summary>
+	/// One tree level in morton order, empty nodes have min > max
+	/// </summary>
+	struct Level {
+		std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+		std::vector<uint8_t> dirty;
+		std::vector<uint8_t> rejectPlane; //plane that last rejected the node, noPlane if none
+	};
+
+	struct VisibleLeaf {
+		unsigned int leaf;
+		uint32_t planeMask; //planes the leaf is not fully inside
+		uint32_t patchMask;
+	};
+
+	static constexpr uint8_t noPlane = 0xFF;
+	static constexpr float planeEpsilon = 1e-4f; //largest plane change that still reuses the last culling result
+
+	static unsigned int morton(unsigned int col, unsigned int row);
+
+	void setLeaf(unsigned int leaf, const glm::vec3& min, const glm::vec3& max);
+	/// <summary>
+	/// Recompute the bounds of all ancestors of changed leaves
+	/// </summary>
+	void refit();
+	/// <summary>
+	/// Test the four children starting at first on level against the planes in planeMask
+	/// </summary>
+	void cullChildren(unsigned int level, unsigned int first, uint32_t planeMask);
+	/// <summary>
+	/// Add every chunk below node without testing
+	/// </summary>
+	void addSubtree(unsigned int level, unsigned int node);
+	void addLeaf(unsigned int leaf, uint32_t planeMask);
+	/// <summary>
+	/// Planes equal the planes of the last culling pass within planeEpsilon
+	/// </summary>
+	bool planesUnchanged() const;
+	/// <summary>
+	/// Remove visible leaves hidden behind nearer ones, leaves are tested nearest first and then added as occluders
+	/// </summary>
+	void cullOccluded();
+	/// <summary>
+	/// Rasterize the occluder cells of leaf, the terrain is never below them
+	/// </summary>
+	void addOccluder(unsigned int leaf);
+	/// <summary>
+	/// Test the patches of leaf against the planes in planeMask, returns the mask of visible patches
+	/// </summary>
+	uint32_t cullPatches(unsigned int leaf, uint32_t planeMask);
+	glm::vec3 leafMin(unsigned int leaf) const;
+	glm::vec3 leafMax(unsigned int leaf) const;
+	int selectLod(unsigned int slot, float distance) const;
+
+	unsigned int gridSize = 0;
+	unsigned int depth = 0; //level of the root, leaves are level 0
+	int maxLod = 16;
+
+	std::vector<Level> levels;
+	std::vector<int> leafSlot; //slot of every leaf, -1 for leaves outside the grid
+	std::vector<unsigned int> slotLeaf;
+	unsigned int originCol = 0, originRow = 0;
+	std::vector<glm::vec3> movedMin, movedMax; //bounds of every slot while the leaves are moved
+	std::vector<unsigned int> changedLeaves, changedNodes;
+
+	std::vector<float> lodErrors[5]; //per slot
+	std::vector<int> selectedLods; //per slot, lod chosen the last time the slot was selected
+	std::vector<int> minLods; //per slot
+	unsigned int occluderCells = 0;
+	std::vector<float> occluderHeights; //occluderCells^2 per slot
+	unsigned int patchesPerSide = 1;
+	std::vector<float> patchMinHeights, patchMaxHeights; //patchesPerSide^2 per slot
+	std::vector<unsigned int> lodFrame; //frame the lod of the slot was selected in
+	unsigned int frame = 0;
+
+	glm::vec3 camPos{ 0.0f };
+	LodParameters params{};
+
+	std::vector<Plane> planes, culledPlanes;
+	std::vector<VisibleLeaf> visibleLeaves, frustumLeaves; //result of the last culling pass
+	bool patchCulling = true;
+	unsigned int culledPatches = 0;
+	std::vector<DrawItem> drawList;
+	bool temporalCoherence = true;
+	bool culledValid = false;
+	bool reused = false;
+
+	bool occlusionCulling = false;
+	glm::mat4 viewProjection{ 1.0f };
+	OcclusionBuffer occlusion{ 160, 90 };
+	std::vector<std::pair<float, unsigned int>> leavesByDistance;
+	unsigned int occludedChunks = 0;
+	static constexpr unsigned int maxOccluders = 16; //nearest unoccluded chunks rasterized as occluders
+	unsigned int nodesTested = 0;
+	unsigned int planeTests = 0;
+};
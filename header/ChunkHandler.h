@@ -1,8 +1,16 @@
 #pragma once
 #include <vector>
 #include "Mesh.h"
+#include "Shader.h"
+#include "ChunkIndexBuffer.h"
+#include "AdaptiveIndexBuffer.h"
+#include "CdlodTerrain.h"
+#include "GeometryClipmap.h"
+#include "ChunkCuller.h"
+#include "FrameStats.h"
 #include <glm/gtc/noise.hpp>
-#include "BoundingBox.h"
+#include "AABB.h"
+#include "TerrainNoise.h"
 #include <glm/gtx/string_cast.hpp>
 #include <iostream>
 #include "CameraPlane.h"
@@ -10,137 +18,417 @@
 #include <thread>
 #include <mutex>
 #include <future>
-
-enum chunkChecker {
-	inside, up, down, left, right
-};
+#include <unordered_map>
+#include <array>
+#include <memory>
+#include <unordered_set>
+#include <deque>
+#include <list>
+#include <chrono>
+#include "WorkerPool.h"
+#include "ScratchArena.h"
+#include "HeapCounter.h"
 
 class ChunkHandler {
 public:
 	/// <summary>
-	/// Create a chunk handler 
+	/// Create a chunk handler, the chunks within gridSize / 2 chunks of the chunk the camera is over are kept.
+	/// They are generated by the workers nearest first, at the coarsest lod their distance allows so they show up quickly,
+	/// and added by updateChunks as they finish. As the camera approaches they are generated again at the finer lods they need
 	/// </summary>
-	/// <param name="_gridSize"> number of chunks in a A x A grid </param>
+	/// <param name="_gridSize"> number of chunks across the circle of kept chunks, fits in a A x A grid </param>
 	/// <param name="nrVertices">number of vertecies per chunk excluding skirts</param>
 	/// <param name="spacing">distance between vertices</param>
 	/// <param name="yscale">how much to scale in the y direction</param>
 	ChunkHandler(unsigned int _gridSize, unsigned int _nrVertices, float _spacing, float _yscale);
 
 
+	/// <summary>
+	/// Draw every chunk, ie. turn frustum culling off until the next cullTerrainChunk
+	/// </summary>
 	void cullTerrain(bool cull) {
-		for (auto chunk : chunks) {
-			chunk->drawChunk = cull;
-		}
+		if (cull)
+			culler.setPlanes({});
 	}
 
-	void draw(const glm::vec3& camposition) {
+	/// <summary>
+	/// Stitch chunk edges to the lod of the neighboring chunks instead of hiding the cracks with skirts
+	/// </summary>
+	void useEdgeStitching(bool stitch) {
+		stitchEdges = stitch;
+	}
 
-		//auto p0 = currentChunk->getPostition(currentChunk->index(currentChunk->nrVertices / 2, currentChunk->nrVertices / 2));
-		for (Chunk* chunk : chunks)	
-		{
-			auto p1 = chunk->getPostition(chunk->index(chunk->nrVertices / 2, chunk->nrVertices / 2));
-			int lod = computeLOD(camposition, p1);
-			chunk->draw(lod);
-		}
+	/// <summary>
+	/// Triangulate every chunk to its own heights instead of drawing the regular lod grids, see AdaptiveIndexBuffer.
+	/// Chunks are then always joined with skirts
+	/// </summary>
+	void useAdaptiveMeshing(bool use);
+
+	/// <summary>
+	/// Draw the chunks as CDLOD quadtrees with morphing lods instead of per chunk meshes, see CdlodTerrain.
+	/// The chunk meshes are released while CDLOD is used and rebuilt when it is turned off, the chunk vertices are then only kept in the CDLOD height texture
+	/// </summary>
+	void useCdlod(bool use);
+
+	/// <summary>
+	/// Draw the terrain beyond the chunk grid as a geometry clipmap, see GeometryClipmap. Created on first use
+	/// </summary>
+	void useFarField(bool use);
+
+	/// <summary>
+	/// Keep the vertices of the chunks in RAM once they are uploaded. Otherwise a chunk keeps only its bounds and culling heights
+	/// and reads the vertices back from VRAM when they are needed, which is when switching to CDLOD or building adaptive index sets
+	/// </summary>
+	void keepChunkGeometry(bool keep);
+
+	/// <summary>
+	/// Distance the far field reaches from the camera, only valid once the far field is used
+	/// </summary>
+	float getFarFieldReach() const {
+		return farField.getReach();
 	}
 
-	void drawWithoutLOD() {
-		for (Chunk* chunk : chunks) {
-			chunk->draw(1);
-		}
+	void draw(const glm::vec3& camposition, const Shader& shader);
+
+	/// <summary>
+	/// Draw every chunk at lod 1. The lods are still selected for camposition, so the chunks do not pop when drawing with lods again
+	/// </summary>
+	void drawWithoutLOD(const glm::vec3& camposition, const Shader& shader);
+
+	const FrameStats& getStats() const {
+		return stats;
 	}
 
-	void drawBoundingBox() {
-		for (auto chunk : chunks) {
-			chunk->drawBoundingBox();
-		}
+	/// <summary>
+	/// Draw the bounds of the chunks drawn by the last draw call as lines, batched into one buffer that is refilled every call
+	/// </summary>
+	void drawBoundingBox();
+
+	/// <summary>
+	/// Set the projection used to turn geometric lod errors into pixel errors
+	/// </summary>
+	/// <param name="fovY">vertical field of view in radians</param>
+	/// <param name="viewportHeight">height of the viewport in pixels</param>
+	void setProjection(float fovY, unsigned int viewportHeight) {
+		pixelsPerUnit = viewportHeight / (2.0f * std::tan(fovY / 2.0f));
+	}
+
+	/// <summary>
+	/// Largest allowed screen space error in pixels when selecting lod
+	/// </summary>
+	void setPixelTolerance(float tolerance) {
+		pixelTolerance = tolerance;
 	}
 
-	int computeLOD(const glm::vec3& position, const glm::vec3& chunkposition) {
-		float d = glm::distance(position, chunkposition);
-		float chunkWidth = (nrVertices - 1) * spacing;
-		// Highest lod 
-		if (d < 1.5f * chunkWidth) {
-			return 1;
-		}
-		// Mid lod
-		if (d <= 2.5f * chunkWidth)
-		{
-			return 2;
-		}
-		// Lowest lod
-		else if (d <= 3.5f * chunkWidth) {
-			return 4;
-		}
-		else if (d <= 5.0f * chunkWidth)
-			return 8;
-		else
-			return 16;
+	/// <summary>
+	/// Also cull chunks hidden behind nearer terrain as seen through viewProjection
+	/// </summary>
+	void useOcclusionCulling(bool use, const glm::mat4& viewProjection) {
+		culler.setOcclusion(use, viewProjection);
 	}
 
 	/// <summary>
-	/// Update chunk the camera is currently over ie. get center chunk
+	/// Cull the patches of chunks crossing the frustum one by one
+	/// </summary>
+	void usePatchCulling(bool use) {
+		culler.usePatchCulling(use);
+	}
+
+	/// <summary>
+	/// Let culling start from last frame's result, see ChunkCuller::useTemporalCoherence
+	/// </summary>
+	void useTemporalCoherence(bool use) {
+		culler.useTemporalCoherence(use);
+	}
+
+	/// <summary>
+	/// Factor on the pixel tolerance, > 1 moves every lod closer to the camera
+	/// </summary>
+	void setLodScale(float scale) {
+		lodScale = scale;
+	}
+
+	/// <summary>
+	/// Only draw chunks at most rings chunks away from the chunk the camera is over, see withinRadius
+	/// </summary>
+	void setDrawRings(unsigned int rings) {
+		drawRings = rings;
+	}
+
+	/// <summary>
+	/// Update chunk the camera is currently over ie. get center chunk. Chunks that left the circle around it are deleted
+	/// and the missing ones generated, chunks finished generating since the last call are added
 	/// </summary>
-	/// <param name="ch">what chunk direction did we move into</param>
 	void updateChunks(const glm::vec3& camPos);
 
 	/// <summary>
-	/// Evaluate if a chunk is within the camera frustum
+	/// Seconds from creation, or the last jump of more than one chunk, until every chunk around the camera was added. Negative while they are generated
+	/// </summary>
+	float getFillTime() const {
+		return filling ? -1.0f : fillTime;
+	}
+
+	/// <summary>
+	/// Set the camera frustum the chunks are culled against in the next draw
 	/// based on psuedo code in figure 4 http://www.cse.chalmers.se/~uffe/vfc_bbox.pdf
 	/// </summary>
 	/// <param name="cameraPlanes"></param>
 	void cullTerrainChunk(const std::vector<CameraPlane>& cameraPlanes);
 
 private:
+	/// <summary>
+	/// Integer world coordinate of a chunk, chunk x, z starts x, z chunk widths from origin
+	/// </summary>
+	struct ChunkCoord {
+		int x, z;
+
+		bool operator==(const ChunkCoord& other) const {
+			return x == other.x && z == other.z;
+		}
+	};
+	struct ChunkCoordHash {
+		size_t operator()(const ChunkCoord& coord) const {
+			return std::hash<long long>{}(static_cast<long long>(coord.x) << 32 ^ static_cast<unsigned int>(coord.z));
+		}
+	};
+
+	/// <summary>
+	/// Heights of the full resolution vertices along the north, south, west and east side of a chunk, corners included.
+	/// Neighboring chunks get the same heights for the side between them, see seamHeights
+	/// </summary>
+	using ChunkSides = std::array<std::shared_ptr<const std::vector<float>>, 4>;
+
 	class Chunk {
 	public:
 		/// <summary>
-		/// Create a chunk at position xpos, zpos, with size as number of vertices
+		/// Create a chunk at position xpos, zpos, with size as number of vertices.
+		/// Only the full resolution grid is stored, coarser lods are drawn with the shared index sets in ChunkIndexBuffer.
+		/// A chunk generated at a step above 1 only samples every step-th vertex and the vertices along its sides,
+		/// so it can be drawn at lod step and coarser, and stitched to any neighbor
 		/// </summary>
 		/// <param name="_size">number of vertices in the chunk</param>
 		/// <param name="xpos">start position x</param>
 		/// <param name="zpos">start position z</param>
 		/// <param name="_spacing">how much space between each vertex</param>
-		Chunk(unsigned int _size, unsigned int lod, float xpos, float zpos, float _spacing, unsigned int _id);
+		/// <param name="_step">finest lod to generate</param>
+		/// <param name="pool">computes bands of rows in parallel, the chunk is generated on the calling thread alone without one</param>
+		/// <param name="sides">heights of the side vertices, sampled by the chunk itself if not given</param>
+		Chunk(unsigned int _size, float xpos, float zpos, float _spacing, unsigned int _id, unsigned int _step = 1, WorkerPool* pool = nullptr,
+			const ChunkSides* sides = nullptr);
 		//Chunk(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& bBox, size_t _size);
 
-		~Chunk() {
-			mesh.deleteMesh();
-			boundingBox.deleteBoundingBox();
-			if (higherLod != nullptr)
-			{
-				delete higherLod;
-			}
+		/// <summary>
+		/// Create an empty chunk for ChunkPool, it is drawn only once generated
+		/// </summary>
+		Chunk(unsigned int _size, float _spacing);
+
+		Chunk(const Chunk&) = delete;
+		Chunk& operator=(const Chunk&) = delete;
+
+		/// <summary>
+		/// Generate the chunk at xpos, zpos, see the constructor. A recycled chunk generates into the storage it already has
+		/// </summary>
+		/// <param name="heights">range of estimateHeights, debug builds assert that the generated heights are inside it</param>
+		/// <param name="belowGround">the range of estimateHeights stays below ground level, the chunk is then made flat without being generated</param>
+		void generate(float xpos, float zpos, unsigned int _id, unsigned int _step, WorkerPool* pool, const ChunkSides* sides,
+			const std::pair<float, float>& heights, bool belowGround);
+
+		/// <summary>
+		/// Remove the mesh and adaptive index sets from VRAM so the chunk can be generated again, the vertex storage if not released and the culling storage are kept.
+		/// Chunks are not removed from VRAM when destroyed, call this first
+		/// </summary>
+		void recycle();
+
+		/// <summary>
+		/// Hand over the vertices once they are in VRAM, in the mesh or a CDLOD layer. The chunk keeps its bounds and culling heights and reads the vertices back when it needs them.
+		/// Returns their storage for another chunk to generate into, flat chunks give up the storage they kept
+		/// </summary>
+		std::vector<TerrainVertex> releaseGeometry();
+
+		/// <summary>
+		/// Read released vertices back from VRAM
+		/// </summary>
+		void restoreGeometry();
+
+		/// <summary>
+		/// Storage to generate into, for a chunk that released its own
+		/// </summary>
+		void setStorage(std::vector<TerrainVertex>&& storage) {
+			vertices = std::move(storage);
+			vertices.clear();
+		}
+
+		bool hasStorage() const {
+			return vertices.capacity() > 0;
+		}
+
+		const AABB& getBounds() const {
+			return bounds;
+		}
+
+		/// <summary>
+		/// Largest height difference between the full resolution grid and the surface of lod 1, 2, 4, 8, 16, estimated for chunks with a step above 1
+		/// </summary>
+		const float* getLodErrors() const {
+			return lodErrors;
+		}
+
+		/// <summary>
+		/// Lowest height of every lod 16 cell, row by row
+		/// </summary>
+		const float* getOccluderHeights() const {
+			return occluderHeights.data();
+		}
+
+		/// <summary>
+		/// Height range of every patch, row by row
+		/// </summary>
+		const float* getPatchMinHeights() const {
+			return patchMinHeights.data();
+		}
+		const float* getPatchMaxHeights() const {
+			return patchMaxHeights.data();
+		}
+
+		/// <summary>
+		/// True if the chunk is entirely at ground level, it is then drawn with the shared flat mesh and stores no vertices
+		/// </summary>
+		bool isFlat() const {
+			return flat;
 		}
 
-		glm::vec3 getPostition(int index = 0) {
-			return mesh.vertices[index].position;
+		/// <summary>
+		/// Finest lod the chunk has vertices for, 1 once it is generated at full resolution. Flat chunks are exact at every lod
+		/// </summary>
+		int getStep() const {
+			return step;
 		}
 
-		void draw(int _lod) {
-			if (drawChunk) {
-				if(_lod == lod)
-					mesh.draw(GL_TRIANGLES);
-				else
-				{
-					if(higherLod != nullptr)
-					{
-						higherLod->draw(_lod);
-					}
-				}
+		/// <summary>
+		/// Conservative height range of the noise of the chunk at xpos, zpos and of the vertices around it used for its normals
+		/// </summary>
+		static std::pair<float, float> estimateHeights(float xpos, float zpos, unsigned int _size, float _spacing);
+
+		/// <summary>
+		/// True if the chunk at xpos, zpos can be made flat without being generated: heights, the range of estimateHeights, stays below
+		/// ground level and so does a coarse grid of samples over the chunk and its margin. The samples catch an estimate that is too low
+		/// </summary>
+		static bool belowGround(float xpos, float zpos, unsigned int _size, float _spacing, const std::pair<float, float>& heights);
+
+		/// <summary>
+		/// Packed vertices of a chunk at ground level, the same for every flat chunk since positions are relative to the chunk origin
+		/// </summary>
+		/// <param name="_nrVertices">number of vertices per side excluding skirts</param>
+		static std::vector<TerrainVertex> flatVertices(unsigned int _nrVertices);
+
+		void draw(int lod, const Shader& shader, const ChunkIndexBuffer& lodIndices) {
+			const ChunkIndexBuffer::Range& range = lodIndices.getRange(lod);
+			setUniforms(shader, lod);
+			drawMesh->draw(GL_TRIANGLES, range.count, range.offset);
+		}
+
+		/// <summary>
+		/// Draw without skirts, the four edges are stitched to the lod of the neighbors given in north, south, west, east order
+		/// </summary>
+		void drawStitched(int lod, const int neighborLods[4], const Shader& shader, const ChunkIndexBuffer& lodIndices) {
+			GLsizei counts[5];
+			unsigned int offsets[5];
+			counts[0] = lodIndices.getCoreRange(lod).count;
+			offsets[0] = lodIndices.getCoreRange(lod).offset;
+			for (int side = 0; side < 4; ++side) {
+				const ChunkIndexBuffer::Range& range = lodIndices.getEdgeRange(lod, static_cast<ChunkIndexBuffer::Side>(side), neighborLods[side]);
+				counts[side + 1] = range.count;
+				offsets[side + 1] = range.offset;
 			}
+			setUniforms(shader, lod);
+			drawMesh->draw(GL_TRIANGLES, counts, offsets, 5);
 		}
-		void drawBoundingBox() {
-			if (drawChunk)
-				boundingBox.draw();
+		/// <summary>
+		/// Draw a list of ranges of the shared element buffer at lod
+		/// </summary>
+		void drawRanges(int lod, const GLsizei* counts, const unsigned int* offsets, int nrRanges, const Shader& shader) {
+			setUniforms(shader, lod);
+			drawMesh->draw(GL_TRIANGLES, counts, offsets, nrRanges);
+		}
+		/// <summary>
+		/// Upload the vertices, flat chunks use flatMesh and flatAdaptiveIndices instead
+		/// </summary>
+		/// <param name="adaptive">draw with the adaptive index sets, see useAdaptiveIndices</param>
+		void bakeMeshes(const ChunkIndexBuffer& lodIndices, TerrainMesh& flatMesh, const AdaptiveIndexBuffer& flatAdaptiveIndices, bool adaptive);
+
+		/// <summary>
+		/// Remove the mesh from VRAM. Released vertices are read back first so the chunk can be baked again, unless they are in a CDLOD layer
+		/// </summary>
+		void releaseMesh();
+
+		/// <summary>
+		/// Copy the packed vertices to a layer of the CDLOD height map, flat chunks use its flat layer.
+		/// The vertices must not be released, see restoreGeometry. The chunk keeps them if no layer was free
+		/// </summary>
+		void uploadHeights(CdlodTerrain& _cdlod);
+
+		unsigned int getHeightLayer() const {
+			return heightLayer;
 		}
 
-		void bakeMeshes();
+		/// <summary>
+		/// Quadtree data of the chunk for CDLOD node selection
+		/// </summary>
+		CdlodTerrain::ChunkNodes getNodes() const {
+			return { { XPOS, ZPOS }, minHeight, maxHeight, heightLayer, nodeMinHeights.data(), nodeMaxHeights.data(), ChunkIndexBuffer::lodLevel(step) };
+		}
+
+		/// <summary>
+		/// Triangulate the chunk to its own heights, does not need a GL context so it can run on the generating thread.
+		/// Chunks with a step above 1 are not triangulated and draw with the shared index sets
+		/// </summary>
+		/// <param name="pool">triangulates the patches in parallel if given</param>
+		void buildAdaptiveIndices(WorkerPool* pool = nullptr);
+
+		/// <summary>
+		/// Decode the heights of the full resolution grid without skirts from the packed vertices, read back from VRAM if released.
+		/// heights holds (nrVertices - 2)^2 floats, row by row
+		/// </summary>
+		void decodeHeights(float* heights) const;
+
+		/// <summary>
+		/// True if the chunk is triangulated to its own heights but has no adaptive index sets yet
+		/// </summary>
+		bool needsAdaptiveIndices() const {
+			return !flat && step == 1 && !adaptiveIndices.isBuilt();
+		}
+
+		/// <summary>
+		/// Take adaptive index sets built elsewhere from decodeHeights, they are uploaded on first use
+		/// </summary>
+		void setAdaptiveIndices(AdaptiveIndexBuffer&& indices) {
+			adaptiveIndices = std::move(indices);
+		}
+
+		/// <summary>
+		/// True if the mesh draws with adaptive index sets once adaptive meshing is used, flat chunks always can
+		/// </summary>
+		bool hasAdaptiveIndices() const {
+			return drawAdaptiveIndices->isBaked();
+		}
 
 		/// <summary>
-		/// Create noisy point at position x,z computes height y
+		/// Switch the mesh between the adaptive index sets of the chunk and the shared lodIndices, the adaptive sets are uploaded on first use.
+		/// A chunk without adaptive sets keeps drawing with lodIndices until they are given to it, see needsAdaptiveIndices.
+		/// Flat chunks draw with flatMesh, which the chunk handler switches
+		/// </summary>
+		void useAdaptiveIndices(bool use, const ChunkIndexBuffer& lodIndices);
+
+		/// <summary>
+		/// Adaptive index sets the chunk draws with while adaptive meshing is used
+		/// </summary>
+		const AdaptiveIndexBuffer& getAdaptiveIndices() const {
+			return *drawAdaptiveIndices;
+		}
+
+		/// <summary>
+		/// Create noisy point at position x,z computes height y with TerrainNoise
 		/// https://thebookofshaders.com/13/
-		/// TODO: make noise dependent on variables
 		/// </summary>
 		glm::vec3 createPointWithNoise(float x, float z, float* minY = nullptr, float* maxY = nullptr) const;
 		/// <summary>
@@ -158,29 +446,106 @@ private:
 		/// </summary>
 		/// <param name="p">: neighboring poins: ne, n, nw, w, sw, s, se, e </param>
 		/// <param name="v0">: starting point </param>
-		glm::vec3 computeNormal(const std::vector<glm::vec3>& p,const glm::vec3& v0) const;
+		glm::vec3 computeNormal(const std::array<glm::vec3, 8>& p,const glm::vec3& v0) const;
+
+		static glm::vec3 setColorFromLOD(int lod);
+
+		/// <summary>
+		/// Grid coordinate of vertex i, skirts share coordinate with their neighbor
+		/// </summary>
+		unsigned int gridCoordinate(int i) const;
+
+		/// <summary>
+		/// Pack vertex at width, depth into the 8 byte terrain format, requires minHeight and maxHeight to be computed
+		/// </summary>
+		TerrainVertex packVertex(const Vertex& v, int width, int depth) const;
+
+		/// <summary>
+		/// True if the vertex at grid coordinate x, z has a height, ie. it is on the step lattice or on a side of the chunk
+		/// </summary>
+		bool isSampled(int x, int z) const {
+			int span = nrVertices - 3;
+			return (x % step == 0 && z % step == 0) || x == 0 || z == 0 || x == span || z == span;
+		}
+
+		/// <summary>
+		/// Full precision vertices of a chunk being generated, in the arena of the generating thread
+		/// </summary>
+		using Grid = ScratchVector<Vertex>;
+
+		/// <summary>
+		/// Grid of a chunk generated at a step above 1. Normals on the step lattice are computed from the lattice neighbors,
+		/// the other side vertices blend the normals of the two lattice vertices around them
+		/// </summary>
+		Grid sampleGrid(float& minY, float& maxY, WorkerPool* pool, const ChunkSides* sides) const;
+
+		/// <summary>
+		/// Height of the vertex at grid coordinate x, z on a side of the chunk, taken from sides if given
+		/// </summary>
+		float sideHeight(const ChunkSides* sides, int x, int z) const;
+
+		/// <summary>
+		/// Compute bounds, lod errors and culling heights from the sampled vertices of grid and pack it
+		/// </summary>
+		void packGrid(const Grid& grid, float minY, float maxY, WorkerPool* pool);
 
-		glm::vec3 setColorFromLOD();
+		/// <summary>
+		/// Call band(band, first row, end row) for every band of bandRows rows out of rows, on pool if there is one and in order otherwise
+		/// </summary>
+		template<typename Band>
+		static void forRowBands(WorkerPool* pool, int rows, const Band& band);
 
-		chunkChecker checkMovement(const glm::vec3& pos);
+		static int rowBandCount(int rows) {
+			return (rows + bandRows - 1) / bandRows;
+		}
+
+		/// <summary>
+		/// Compute the max error of every lod against lod step, the coarse surface is interpolated over the same triangles the index sets draw.
+		/// The error of lod step itself is estimated
+		/// </summary>
+		void computeLodErrors(const Grid& grid);
 
 		/// <summary>
-		/// returns the p and n-vertex of the bounding box computed from the normal n of the plane
-		/// table ref: https://old.cescg.org/CESCG-2002/DSykoraJJelinek/
+		/// Compute the lowest height in every lod 16 cell, the terrain never goes below these so they can be used as occluders
 		/// </summary>
-		/// <param name="n">plane normal</param>
-		/// <returns></returns>
-		std::pair<glm::vec3, glm::vec3> computePN(const glm::vec3& n) const;
+		void computeOccluderHeights(const Grid& grid);
 
-		Chunk* generateLOD(unsigned int nrVerticies, unsigned int _lod, float xpos, float zpos, float _spacing, unsigned int id);
+		/// <summary>
+		/// Compute the height range of every patch
+		/// </summary>
+		void computePatchHeights(const Grid& grid);
 
-		unsigned int index(int w, int d) {
+		/// <summary>
+		/// Compute the height range of every CDLOD quadtree node, see CdlodTerrain::nodeIndex
+		/// </summary>
+		void computeNodeHeights(const Grid& grid);
+
+		/// <summary>
+		/// The packed vertices, read back from VRAM into readBack if released
+		/// </summary>
+		const TerrainVertex* packedVertices(ScratchVector<TerrainVertex>& readBack) const;
+
+		/// <summary>
+		/// Read the released vertices back from the mesh, or the CDLOD layer while there is no mesh
+		/// </summary>
+		void readVertices(TerrainVertex* packed) const;
+
+		/// <summary>
+		/// Turn the chunk into a flat chunk at ground level and drop its vertices, their storage is kept for recycling
+		/// </summary>
+		void makeFlat();
+
+		/// <summary>
+		/// Set chunk origin, spacing, height range and lod color used by vertex.vert to unpack the vertices
+		/// </summary>
+		void setUniforms(const Shader& shader, int lod) const;
+
+		unsigned int index(int w, int d) const {
 			return w + nrVertices * d;
 		}
 
-		bool drawChunk = true;
-		unsigned int id;
-		unsigned int lod;
+		unsigned int id; //culler slot, see ChunkHandler::slot
+		ChunkCoord coord{ 0, 0 };
 		const unsigned int nrVertices;	//Number of vertices in chunk
 
 
@@ -188,31 +553,183 @@ private:
 	private:
 		//Helper variables, start pos x & z and spacing between vertices
 		float XPOS, ZPOS, SPACING;
+		//Height range used to quantize the vertex heights
+		float minHeight, maxHeight;
+		static constexpr int bandRows = 16; //rows generated per task, about 10 tasks per chunk
+		static constexpr int belowGroundSamples = 9; //per side of the grid belowGround checks the estimate with
+		float lodErrors[5]; //max geometric error of lod 1, 2, 4, 8, 16
+		std::vector<float> occluderHeights;
+		std::vector<float> patchMinHeights, patchMaxHeights;
+		std::vector<float> nodeMinHeights, nodeMaxHeights;
+
+		std::vector<TerrainVertex> vertices;
+		bool released = false; //vertices only in VRAM, see releaseGeometry
+		AABB bounds; //ignores the skirts
+		bool flat = false;
+		int step = 1; //vertices between the sampled ones, see isSampled
+
+		TerrainMesh mesh;
+		bool meshBaked = false;
+		TerrainMesh* drawMesh{ &mesh }; //mesh, or the shared flat mesh
+		unsigned int heightLayer = CdlodTerrain::flatLayer;
+		const CdlodTerrain* cdlod = nullptr; //holds the vertices in heightLayer once uploaded
+		AdaptiveIndexBuffer adaptiveIndices;
+		const AdaptiveIndexBuffer* drawAdaptiveIndices{ &adaptiveIndices }; //adaptiveIndices, or the shared flat ones
+	};
+	/*End of chunk class*/
 
-		std::vector<Vertex> vertices;
-		std::vector<unsigned int> indices;
-		std::vector<glm::vec3> points;
-		glm::vec3 color;
+	/// <summary>
+	/// Chunk the position is over
+	/// </summary>
+	ChunkCoord chunkCoord(const glm::vec3& pos) const;
+
+	/// <summary>
+	/// x, z where the chunk starts
+	/// </summary>
+	std::pair<float, float> chunkPosition(const ChunkCoord& coord) const;
 
-		Mesh mesh;
-		BoundingBox boundingBox;
-		Chunk* higherLod;
+	/// <summary>
+	/// Culler slot of a chunk. Kept chunks span at most gridSize chunks along x and z, so wrapping the coordinate around the grid
+	/// gives every kept chunk a slot of its own. The culler's tree starts at the corner of the grid around the circle, see ChunkCuller::setOrigin,
+	/// so the wrap lies outside the kept chunks and neighboring chunks are neighboring leaves
+	/// </summary>
+	unsigned int slot(const ChunkCoord& coord) const;
+
+	/// <summary>
+	/// Largest x distance in chunks from the camera's chunk within radius in the row dz chunks away, -1 if the row is beyond radius
+	/// </summary>
+	int rowHalfWidth(int dz, unsigned int radius) const;
+
+	/// <summary>
+	/// True if the center of the chunk is within radius + 0.5 chunks of the center of the chunk the camera is over,
+	/// so a radius of gridSize / 2 reaches the sides of a gridSize x gridSize grid but not its corners
+	/// </summary>
+	bool withinRadius(const ChunkCoord& coord, unsigned int radius) const;
+
+	/// <summary>
+	/// Draw the visible chunks of the culler with their selected lods
+	/// </summary>
+	void drawChunks(const Shader& shader);
+
+	/// <summary>
+	/// Ranges of the element buffer of one chunk drawn in one call, a range that directly follows the previous one is merged into it
+	/// </summary>
+	struct DrawRanges {
+		GLsizei counts[32];
+		unsigned int offsets[32];
+		int size = 0;
+		unsigned int indices = 0;
+
+		void add(const ChunkIndexBuffer::Range& range);
 	};
-	/*End of chunk class*/
 
-	unsigned int index(int col, int row, int size) {
-		return col + size * row;
-	}
+	/// <summary>
+	/// Draw the visible patches of a chunk and its edges, with skirts or stitched to the neighbors
+	/// </summary>
+	void drawPatches(const ChunkCuller::DrawItem& item, const Shader& shader);
 
-	void generateChunk(const std::pair<float, float>& newPos, unsigned int nrVeritices, float spacing, unsigned int id, chunkChecker cc = chunkChecker::inside);
+	/// <summary>
+	/// Draw the visible patches of a chunk and its skirts with the adaptive index sets of the chunk
+	/// </summary>
+	void drawAdaptive(const ChunkCuller::DrawItem& item, const Shader& shader);
+
+	/// <summary>
+	/// Select the CDLOD nodes of the chunks in the frustum and draw them, cellPixels sets the lod ranges, see CdlodTerrain::setRanges
+	/// </summary>
+	void drawCdlod(const glm::vec3& camPos, const Shader& shader, float cellPixels);
+
+	/// <summary>
+	/// Draw the far field around the chunks within drawRings of the camera
+	/// </summary>
+	void drawFarField(const Shader& shader);
+
+	/// <summary>
+	/// Add a generated chunk to the kept chunks and its culling data to its slot
+	/// </summary>
+	void addChunk(Chunk* chunk);
+
+	/// <summary>
+	/// Delete a chunk that left the circle, empty its slot, free its CDLOD layer and give it back to the pool. The caller removes it from chunks
+	/// </summary>
+	void deleteChunk(Chunk* chunk);
+
+	/// <summary>
+	/// Give the vertex storage of a baked chunk to the pool, unless chunks keep their geometry
+	/// </summary>
+	void releaseGeometry(Chunk* chunk);
+
+	/// <summary>
+	/// Copy bounds and lod errors of the chunk to the culler
+	/// </summary>
+	void updateCullData(const Chunk* chunk);
+
+	/// <summary>
+	/// Lod of the chunk next to chunk on side, or lod of the chunk itself if there is no chunk there
+	/// </summary>
+	int neighborLOD(const Chunk* chunk, ChunkIndexBuffer::Side side);
+
+	/// <summary>
+	/// Queue the chunks within the circle that are neither kept nor generating, in the frustum first and nearest first.
+	/// Queued chunks that have not started are sorted again with them, or dropped if they left the circle
+	/// </summary>
+	/// <param name="nearestFirst">ignore the frustum, after a jump it is from the old position</param>
+	void requestChunks(const glm::vec3& camPos, bool nearestFirst = false);
+
+	/// <summary>
+	/// Generate the first queued chunk, or the first queued refinement once no chunk is missing. Run by the generator workers
+	/// </summary>
+	void generateNextChunk();
+
+	void generateChunk(ChunkCoord coord, unsigned int step, bool adaptive, const std::pair<float, float>& heights, bool belowGround);
+
+	/// <summary>
+	/// Queue the coarse chunks whose lod the camera came close enough to need finer, nearest first
+	/// </summary>
+	void requestRefinements(const glm::vec3& camPos);
+
+	/// <summary>
+	/// Distance within which lod 1, 2, 4, 8, 16 is too coarse for a chunk. The lod errors of a chunk are not known before it is generated,
+	/// so the ranges follow TerrainNoise::interpolationError, or the lod ranges of CDLOD while it is used.
+	/// Both are widened by the hysteresis margin of lod selection so chunks are refined before a lod they lack is needed
+	/// </summary>
+	void computeStepRanges(float ranges[5]) const;
+
+	/// <summary>
+	/// Coarsest lod a chunk with bounds can be generated at seen from camPos, see computeStepRanges
+	/// </summary>
+	unsigned int generationStep(const AABB& bounds, const glm::vec3& camPos, const float ranges[5]) const;
 
 	/// <summary>
-	/// Check if the camera is inside a chunk on x,z plane 
+	/// Conservative bounds of a chunk starting at pos with heights in the range of Chunk::estimateHeights, known before the chunk is generated
 	/// </summary>
-	/// <param name="camPos"></param>
-	chunkChecker checkChunk(const glm::vec3& camPos);
+	AABB estimateBounds(const std::pair<float, float>& pos, const std::pair<float, float>& heights) const;
 
-	std::pair<float, float> newChunkPosition(chunkChecker cc, unsigned int gridId) const;
+	/// <summary>
+	/// Heights along side of the chunk at coord. A seam is sampled by the first chunk next to it that is generated and kept for the chunk
+	/// on its other side. The positions only depend on the chunk origins, so both chunks get the same heights whichever sampled them
+	/// </summary>
+	std::shared_ptr<const std::vector<float>> seamHeights(const ChunkCoord& coord, ChunkIndexBuffer::Side side);
+
+	/// <summary>
+	/// Drop the seams whose chunks both left the circle
+	/// </summary>
+	void pruneSeams();
+
+	/// <summary>
+	/// Queue the adaptive index sets of chunk to be built on the workers, if adaptive meshing is used and the chunk needs them
+	/// </summary>
+	void requestAdaptiveIndices(const Chunk* chunk);
+
+	/// <summary>
+	/// Give the adaptive index sets built since the last frame to their chunks and start the next queued ones.
+	/// Only a few are started at a time since the heights of each are read back on this thread
+	/// </summary>
+	void updateAdaptiveIndices();
+
+	/// <summary>
+	/// Move the scratch counters of the jobs finished since the last frame to stats
+	/// </summary>
+	void takeJobStats();
 
 	std::mutex mu;
 
@@ -221,12 +738,133 @@ private:
 	const float spacing;
 	const float yscale;
 
-	int renderCounter{ static_cast<int>(gridSize) };
+	static constexpr unsigned int patchesPerSide = 5; //(nrVertices - 1) must be divisible by 16 * patchesPerSide
+	static constexpr float skirtDepth = -3.0f; //height the skirts of chunks, CDLOD nodes and the far field hang down to
+	ChunkIndexBuffer lodIndices;
+	AdaptiveIndexBuffer flatAdaptiveIndices; //shared by all flat chunks
+	bool adaptiveMeshing = false;
+	CdlodTerrain cdlod; //created the first time CDLOD is used
+	bool cdlodCreated = false;
+	bool cdlodMode = false;
+	static constexpr unsigned int farFieldCellsPerChunk = 8; //finest clipmap cells per chunk side, chunk sides lie on the finest lattice
+	GeometryClipmap farField; //created the first time the far field is used
+	bool farFieldCreated = false;
+	bool farFieldMode = false;
+	bool farFieldFilled = false; //the first heights were computed on the workers, guarded by mu
+	unsigned int farFieldFillHeights = 0; //heights they computed, guarded by mu
+	bool farFieldReady = false; //filled as seen by updateChunks, the far field is neither updated nor drawn before
+	unsigned int farFieldHeights = 0;
+	unsigned int jobsFinished = 0; //since the last frame, guarded by mu
+	float jobTime = 0.0f;
+	unsigned int adaptiveBuilds = 0;
+	float adaptiveBuildTime = 0.0f;
+	ScratchArena::Counters jobScratch; //used by the jobs finished since the last frame, guarded by mu
+	size_t jobHeapAllocations = 0;
+	ChunkCuller culler;
+	bool stitchEdges = false;
+	FrameStats stats;
+
+	float pixelsPerUnit{ 1.0f }; //screen pixels covered by one world unit at distance 1
+	float pixelTolerance{ 8.0f };
+	float lodScale{ 1.0f };
+	unsigned int drawRings{ gridSize / 2 };
+	static constexpr float lodHysteresis = 0.25f;
+
+	const unsigned int residencyRadius{ gridSize / 2 };
+	glm::vec2 origin; //x, z where chunk 0, 0 starts, the camera starts over it
+	ChunkCoord center{ 0, 0 }; //chunk the camera is over
+	std::unordered_map<ChunkCoord, Chunk*, ChunkCoordHash> chunks; //kept chunks, all within residencyRadius of center
+
+	/// <summary>
+	/// Storage for every chunk, allocated blockSize chunks at a time so chunks lie next to each other in memory. A chunk that is deleted
+	/// keeps its vertex and culling storage and is generated into again, so once the pool has grown to the most chunks alive at the same time
+	/// chunks are generated without allocating
+	/// </summary>
+	class ChunkPool {
+	public:
+		ChunkPool(unsigned int _nrVertices, float _spacing) : nrVertices{ _nrVertices }, spacing{ _spacing } {}
+		/// <summary>
+		/// Destroy every chunk, their buffers in VRAM are left to the GL context
+		/// </summary>
+		~ChunkPool();
 
-	Chunk* currentChunk;
-	std::vector<Chunk*> chunks;
+		ChunkPool(const ChunkPool&) = delete;
+		ChunkPool& operator=(const ChunkPool&) = delete;
 
-	using chunkInfo = std::tuple<Chunk*, chunkChecker>;
-	std::queue<chunkInfo> renderQ;
-	std::queue<chunkChecker> moveQ;
+		/// <summary>
+		/// Take a chunk to generate into, thread safe
+		/// </summary>
+		Chunk* acquire();
+
+		/// <summary>
+		/// Give back a chunk that is no longer used, its buffers must be removed from VRAM first. Thread safe
+		/// </summary>
+		void release(Chunk* chunk);
+
+		/// <summary>
+		/// Keep vertex storage a chunk released for the next chunk acquired without storage. Thread safe
+		/// </summary>
+		void releaseVertices(std::vector<TerrainVertex>&& storage);
+
+		/// <summary>
+		/// Chunks created so far, in use or free
+		/// </summary>
+		unsigned int getAllocated() const;
+
+	private:
+		static constexpr unsigned int blockSize = 32;
+		const unsigned int nrVertices;
+		const float spacing;
+		std::vector<Chunk*> blocks;
+		std::vector<Chunk*> freeChunks;
+		static constexpr unsigned int maxFreeVertices = 32; //more than the chunks generating or waiting to be added at once
+		std::vector<std::vector<TerrainVertex>> freeVertices;
+		mutable std::mutex mu;
+	};
+	ChunkPool chunkPool{ nrVertices, spacing };
+	bool keepGeometry = false; //chunks keep their vertices in RAM once baked
+	std::vector<Chunk*> slotChunks; //chunk in every culler slot, nullptr if empty
+	TerrainMesh flatMesh; //shared by all flat chunks
+
+	struct ChunkJob {
+		ChunkCoord coord;
+		bool adaptive;
+		unsigned int maxStep; //the chunk is generated at this step or finer, as the distance needs when the job starts
+	};
+	std::unordered_set<ChunkCoord, ChunkCoordHash> generating; //chunks queued or started but not yet added
+	std::unordered_set<ChunkCoord, ChunkCoordHash> refining; //kept coarse chunks queued or started at a finer step
+	std::deque<ChunkJob> chunkJobs; //queued chunks in the order they start, guarded by mu
+	std::deque<ChunkJob> refineJobs; //queued refinements, started once chunkJobs is empty, guarded by mu
+	std::queue<Chunk*> renderQ; //generated chunks waiting to be added, guarded by mu
+
+	/// <summary>
+	/// Adaptive index sets of a kept chunk built on a worker. A chunk generated again at the same coord at full resolution
+	/// has the same heights, so the sets are given to whichever chunk is kept there when they are done
+	/// </summary>
+	struct AdaptiveJob {
+		ChunkCoord coord;
+		std::vector<float> heights; //decoded when the job starts, the worker does not touch the chunk
+		float lodErrors[5];
+		AdaptiveIndexBuffer indices;
+		bool done = false; //guarded by mu
+	};
+	static constexpr unsigned int maxAdaptiveJobs = 4;
+	std::deque<ChunkCoord> adaptiveQueue; //kept chunks waiting for their adaptive index sets, nearest first
+	std::unordered_set<ChunkCoord, ChunkCoordHash> adaptiveRequested; //queued or building
+	std::list<AdaptiveJob> adaptiveJobs; //started, a worker only fills in its own job
+	glm::vec3 jobCamPos{ 0.0f }; //camera position and step ranges the workers pick the step of a chunk with, guarded by mu
+	float jobStepRanges[5] = {};
+	unsigned int coarseChunks = 0; //kept chunks with a step above 1
+	std::unordered_map<ChunkCoord, std::shared_ptr<const std::vector<float>>, ChunkCoordHash> seams[2]; //side between a chunk and the chunk east of it, and south of it, guarded by seamMu
+	std::mutex seamMu;
+
+	std::chrono::steady_clock::time_point fillStart;
+	bool filling = false;
+	float fillTime = 0.0f;
+
+	//Debug lines of drawBoundingBox, only created once bounding boxes are drawn
+	std::vector<glm::vec3> boxLines;
+	unsigned int boxVAO = 0, boxVBO = 0;
+
+	WorkerPool generator{ WorkerPool::defaultWorkers() }; //last, so running jobs finish before the members they use are destroyed
 };
\ No newline at end of file
@@ -0,0 +1,153 @@
+#pragma once
+#include <glad/glad.h>
+#include <vector>
+
+/// <summary>
+/// Index sets for every lod of a chunk, shared by all chunks. 
+/// Each chunk only stores the full resolution grid including skirts, coarser lods index a subset of that grid.
+/// A lod can be drawn with skirts, or as a core plus four edge strips that are stitched to the lod of the neighboring chunk.
+/// The core is split into patchesPerSide x patchesPerSide patches stored one after the other, so visible patches can be drawn on their own
+/// </summary>
+class ChunkIndexBuffer {
+public:
+	struct Range {
+		unsigned int offset; //byte offset into the element buffer
+		unsigned int count; //number of indices
+	};
+
+	/// <summary>
+	/// Chunk sides, north is towards -z
+	/// </summary>
+	enum Side {
+		north, south, west, east
+	};
+
+	ChunkIndexBuffer() = default;
+	/// <summary>
+	/// Create index sets for lod 1, 2, 4 .. maxLod
+	/// </summary>
+	/// <param name="_nrVertices">number of vertices per chunk side excluding skirts, (nrVertices - 1) must be divisible by maxLod * patchesPerSide</param>
+	ChunkIndexBuffer(unsigned int _nrVertices, unsigned int _maxLod, unsigned int _patchesPerSide = 1);
+
+	/// <summary>
+	/// Upload the index sets to VRAM
+	/// </summary>
+	void bake();
+
+	/// <summary>
+	/// Remove buffer object from VRAM
+	/// </summary>
+	void deleteBuffer();
+
+	/// <summary>
+	/// Full lod grid including skirts
+	/// </summary>
+	const Range& getRange(unsigned int lod) const {
+		return lods[lodLevel(lod)].skirted;
+	}
+
+	/// <summary>
+	/// Lod grid without skirts and without the outermost ring of cells
+	/// </summary>
+	const Range& getCoreRange(unsigned int lod) const {
+		return lods[lodLevel(lod)].core;
+	}
+
+	/// <summary>
+	/// Part of the core inside patch, patches are numbered row by row. Patch ranges follow each other in the same order
+	/// </summary>
+	const Range& getPatchRange(unsigned int lod, unsigned int patch) const {
+		return lods[lodLevel(lod)].patches[patch];
+	}
+
+	/// <summary>
+	/// Skirts and the outermost ring of cells, together with the core this is the skirted lod grid
+	/// </summary>
+	const Range& getBorderRange(unsigned int lod) const {
+		return lods[lodLevel(lod)].border;
+	}
+
+	/// <summary>
+	/// Outermost ring of cells on one side, with the edge vertices matching a neighbor of neighborLod.
+	/// A finer neighbor stitches to this chunk instead, so the edge then uses this chunk's own lod
+	/// </summary>
+	const Range& getEdgeRange(unsigned int lod, Side side, unsigned int neighborLod) const {
+		unsigned int edgeLod = neighborLod > lod ? neighborLod : lod;
+		return lods[lodLevel(lod)].edges[side][lodLevel(edgeLod)];
+	}
+
+	/// <summary>
+	/// Number of skirt triangles in the full lod grid
+	/// </summary>
+	unsigned int getSkirtTriangles(unsigned int lod) const {
+		return lods[lodLevel(lod)].skirtTriangles;
+	}
+
+	unsigned int getEBO() const {
+		return EBO;
+	}
+
+	unsigned int getMaxLod() const {
+		return maxLod;
+	}
+
+	unsigned int getPatchesPerSide() const {
+		return patchesPerSide;
+	}
+
+	/// <summary>
+	/// lod 1, 2, 4 .. -> 0, 1, 2 ..
+	/// </summary>
+	static unsigned int lodLevel(unsigned int lod);
+
+private:
+	struct LodSet {
+		Range skirted;
+		Range core;
+		std::vector<Range> patches; //core split into patches
+		Range border;
+		std::vector<Range> edges[4]; //indexed by lod level of the edge, levels finer than this lod are empty
+		unsigned int skirtTriangles;
+	};
+
+	/// <summary>
+	/// Index in the full resolution grid (with skirts) of vertex i in a lod grid (with skirts) of size lodSize
+	/// </summary>
+	unsigned int gridCoordinate(unsigned int i, unsigned int lod, unsigned int lodSize) const;
+
+	/// <summary>
+	/// Index in the full resolution grid of the vertex t steps along side and s steps inwards from the first non skirt vertex
+	/// </summary>
+	unsigned int edgeIndex(Side side, unsigned int t, unsigned int s) const;
+
+	/// <summary>
+	/// Add triangle a, b, c counter clockwise seen from above
+	/// </summary>
+	void addTriangle(unsigned int a, unsigned int b, unsigned int c);
+
+	/// <summary>
+	/// Add the two triangles of the grid cell spanned by grid coordinates x1, z1 and x2, z2
+	/// </summary>
+	void addCell(unsigned int x1, unsigned int z1, unsigned int x2, unsigned int z2);
+
+	void addLod(unsigned int lod);
+	/// <summary>
+	/// Add the core patch by patch and return the range covering all of them
+	/// </summary>
+	Range addCore(unsigned int lod, std::vector<Range>& patches);
+	Range addBorder(unsigned int lod);
+	/// <summary>
+	/// Triangulate the strip between the chunk edge sampled every edgeLod steps and the first inner row sampled every lod steps
+	/// </summary>
+	Range addEdge(unsigned int lod, Side side, unsigned int edgeLod);
+
+	unsigned int nrVertices; //vertices per side in the full resolution grid including skirts
+	unsigned int maxLod;
+	unsigned int patchesPerSide;
+
+	std::vector<unsigned int> indices;
+	std::vector<LodSet> lods;
+
+	unsigned int EBO;
+	bool baked = false;
+};
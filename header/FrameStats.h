@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+
+/// <summary>
+/// Counters collected while drawing one frame of terrain
+/// </summary>
+struct FrameStats {
+	unsigned int drawCalls = 0;
+	unsigned int chunksDrawn = 0;
+	unsigned int chunksResident = 0; //chunks kept around the camera, drawn or not
+	unsigned int chunksCoarse = 0; //part of chunksResident not generated at full resolution yet
+	unsigned int chunksAllocated = 0; //chunks the pool holds, kept, generating or free for recycling
+	float fillTime = -1.0f; //seconds from creation, or the last jump, until every chunk around the camera was added, negative while they are generated
+	unsigned int triangles = 0;
+	unsigned int skirtTriangles = 0; //part of triangles that are skirts
+	unsigned int chunksPerLod[5] = {}; //chunks drawn at lod 1, 2, 4, 8, 16
+	unsigned int cullNodesTested = 0; //quadtree nodes tested against the camera planes
+	unsigned int cullPlaneTests = 0; //node against plane tests
+	unsigned int chunksOccluded = 0; //in the frustum but hidden behind nearer terrain
+	unsigned int patchesCulled = 0; //patches outside the frustum in visible chunks
+	unsigned int cdlodNodes = 0; //quadtree nodes drawn in CDLOD mode
+	unsigned int farFieldTriangles = 0; //part of triangles drawn by the clipmap beyond the chunk grid
+	unsigned int farFieldHeights = 0; //clipmap heights computed since the last frame
+	unsigned int jobsFinished = 0; //chunk jobs finished on the workers since the last frame
+	float jobTime = 0.0f; //seconds those jobs took, adaptive index sets built with their chunk included
+	unsigned int jobScratchAllocations = 0; //allocations those jobs took from the arena of their worker
+	size_t jobScratchBytes = 0;
+	unsigned int jobArenaBlocks = 0; //blocks the arenas took from the heap for those jobs, none once every arena fits the largest job
+	unsigned int jobHeapAllocations = 0; //operator new calls of those jobs, workers helping them included, zero unless HeapCounter::enabled
+	unsigned int adaptiveBuilds = 0; //adaptive index sets built since the last frame, with their chunk or on their own
+	float adaptiveBuildTime = 0.0f; //seconds building them took on the workers
+	unsigned int adaptivePending = 0; //chunks drawn with the regular index sets until their adaptive sets are built
+	bool cullReused = false; //camera and chunks unchanged, last culling result was drawn
+
+	//LodGovernor state
+	float smoothedFrameTime = 0.0f;
+	float lodScale = 1.0f;
+	unsigned int drawRings = 0;
+
+	void reset() {
+		*this = FrameStats{};
+	}
+};
@@ -0,0 +1,142 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <utility>
+#include "Mesh.h"
+#include "Shader.h"
+#include "ChunkCuller.h"
+
+/// <summary>
+/// Far field beyond the chunk grid drawn as a geometry clipmap: nested square windows of the same number of cells centered on the camera,
+/// each with twice the spacing of the one inside it. A level only draws the ring around the next finer level, the finest level leaves a hole for the chunks.
+/// Heights of each level live in one layer of a texture array addressed toroidally by lattice coordinate, so when a window moves
+/// only the L-shaped strip of rows and columns that scrolled into it is computed and uploaded.
+/// Every other vertex on the outer border of a level takes the height of the coarser edge it lies on so the levels meet without cracks,
+/// and a skirt around the hole covers the cracks to the chunk grid. The skirt is needed with stitched chunk edges too, stitching only joins chunks to each other
+/// </summary>
+class GeometryClipmap {
+public:
+	static constexpr unsigned int levels = 5;
+
+	GeometryClipmap() = default;
+	/// <summary>
+	/// Create the level geometry and an empty height texture, heights are computed by fill or on the first update
+	/// </summary>
+	/// <param name="_cells">cells per level side, even and at most 254</param>
+	/// <param name="_spacing">lattice spacing of the finest level</param>
+	/// <param name="_anchor">world x, z of lattice coordinate 0</param>
+	/// <param name="_skirtDepth">height the skirt around the hole hangs down to, the same as the chunk skirts</param>
+	GeometryClipmap(unsigned int _cells, float _spacing, const glm::vec2& _anchor, float _skirtDepth);
+
+	/// <summary>
+	/// Remove buffer objects and the height texture from VRAM
+	/// </summary>
+	void deleteBuffers();
+
+	/// <summary>
+	/// Center the levels on camPos and compute the heights that scrolled into view, returns the number of heights computed
+	/// </summary>
+	unsigned int update(const glm::vec3& camPos);
+
+	/// <summary>
+	/// Compute the heights of every level centered on camPos without uploading them, so the first heights can be computed on another thread
+	/// while the clipmap is not used. The next update uploads them and only computes what scrolled in since. Returns the number of heights computed
+	/// </summary>
+	unsigned int fill(const glm::vec3& camPos);
+
+	/// <summary>
+	/// Stop leaving out any area of the finest level
+	/// </summary>
+	void clearHole() {
+		holes.clear();
+	}
+
+	/// <summary>
+	/// Also leave out the area min..max in x, z where chunks are drawn, its sides must lie on the finest lattice.
+	/// The areas must join into one run of cells per row and per column, as the chunks within a radius of the camera do
+	/// </summary>
+	void addHole(const glm::vec2& min, const glm::vec2& max);
+
+	/// <summary>
+	/// Draw the rings, rows of cells outside the frustum of culler are left out. Returns the number of triangles drawn
+	/// </summary>
+	unsigned int draw(const Shader& shader, const ChunkCuller& culler);
+
+	unsigned int getDrawCalls() const {
+		return drawCalls;
+	}
+
+	/// <summary>
+	/// Distance from the camera the coarsest level reaches in every direction
+	/// </summary>
+	float getReach() const {
+		return (cells / 2 - 2) * spacing * (1u << (levels - 1));
+	}
+
+private:
+	struct Level {
+		glm::ivec2 origin{ 0 }; //lattice coordinate of the first vertex, in level steps
+		bool valid = false;
+		bool filled = false; //heights hold the window at origin but are not uploaded yet, see fill
+		float minHeight = 0.0f, maxHeight = 0.0f;
+		std::vector<float> heights; //texel copy, toroidal
+	};
+
+	/// <summary>
+	/// Origin of level for a camera at camPos, even so the window starts on a vertex of the next coarser level
+	/// </summary>
+	glm::ivec2 levelOrigin(unsigned int level, const glm::vec3& camPos) const;
+
+	/// <summary>
+	/// Compute the heights of lattice points x0..x1, z0..z1 (exclusive) of level and upload them. Returns the number of heights computed
+	/// </summary>
+	unsigned int refresh(unsigned int level, int x0, int z0, int x1, int z1);
+
+	/// <summary>
+	/// Compute the heights of lattice points x0..x1, z0..z1 (exclusive) of level into its texel copy, widening its height range
+	/// </summary>
+	void computeHeights(unsigned int level, int x0, int z0, int x1, int z1);
+
+	/// <summary>
+	/// Upload the texels of lattice points x0..x1, z0..z1 (exclusive) of level
+	/// </summary>
+	void uploadHeights(unsigned int level, int x0, int z0, int x1, int z1);
+
+	/// <summary>
+	/// Texel of lattice coordinate k
+	/// </summary>
+	int wrap(int k) const {
+		int size = static_cast<int>(cells) + 1;
+		return ((k % size) + size) % size;
+	}
+
+	/// <summary>
+	/// Rebuild the skirt indices around the hole of the finest level, runs holds the cells of the hole in every row
+	/// </summary>
+	void buildSkirt(const std::vector<glm::ivec2>& runs);
+
+	/// <summary>
+	/// Add the two triangles of a quad given counter clockwise from its top left corner
+	/// </summary>
+	void addCell(std::vector<unsigned int>& target, unsigned int i1, unsigned int i2, unsigned int i3, unsigned int i4) const;
+
+	unsigned int cells;
+	float spacing;
+	glm::vec2 anchor;
+	float skirtDepth;
+	Level levelData[levels];
+	std::vector<std::pair<glm::ivec2, glm::ivec2>> holes; //min and max in finest lattice coordinates
+	std::vector<glm::ivec2> holeRuns; //first and end cell of the hole in every row of the level being drawn, n, n if the row has none
+
+	static constexpr unsigned int blockCells = 16; //cells per row that are frustum culled together
+
+	unsigned int VAO = 0, VBO = 0, EBO = 0;
+	unsigned int gridIndices = 0; //indices of the full window, the skirt indices follow
+	unsigned int skirtIndices = 0;
+	std::vector<glm::ivec2> skirtRuns; //hole the skirt was built for
+	unsigned int drawCalls = 0;
+
+	unsigned int heightTexture = 0;
+	static constexpr int heightUnit = 1; //texture unit, the CDLOD height map is an integer sampler on unit 0
+};
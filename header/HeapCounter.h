@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+
+//Define as 1 to replace the global operator new with one that counts, see HeapCounter
+#ifndef COUNT_HEAP_ALLOCATIONS
+#define COUNT_HEAP_ALLOCATIONS 0
+#endif
+
+/// <summary>
+/// Number of operator new calls made by each thread. The counts only move when COUNT_HEAP_ALLOCATIONS is set, the global
+/// operator new then counts every allocation before taking it from the heap. Without it they stay at zero and nothing is replaced
+/// </summary>
+class HeapCounter {
+public:
+	static constexpr bool enabled = COUNT_HEAP_ALLOCATIONS != 0;
+
+	/// <summary>
+	/// Allocations made by the calling thread since it started, including those charged to it
+	/// </summary>
+	static size_t local();
+
+	/// <summary>
+	/// Count allocations made on other threads for the calling thread, e.g. by workers helping it
+	/// </summary>
+	static void charge(size_t allocations);
+};
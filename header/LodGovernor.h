@@ -0,0 +1,56 @@
+#pragma once
+#include "FrameStats.h"
+
+/// <summary>
+/// Trades terrain quality for frame time. Watches the measured frame time and scales the lod tolerance,
+/// and when that is not enough, lowers the number of chunk rings drawn around the camera.
+/// Adjustments are rate limited and ignore small errors so quality does not oscillate
+/// </summary>
+class LodGovernor {
+public:
+	/// <summary>
+	/// Create a governor
+	/// </summary>
+	/// <param name="_targetFrameTime">frame time to hold in seconds</param>
+	/// <param name="_maxRings">rings drawn at full quality, ie. gridSize / 2</param>
+	LodGovernor(float _targetFrameTime, unsigned int _maxRings);
+
+	/// <summary>
+	/// Feed the time of the last frame in seconds
+	/// </summary>
+	void update(float frameTime);
+
+	/// <summary>
+	/// Go back to full quality
+	/// </summary>
+	void reset();
+
+	/// <summary>
+	/// Factor on the lod pixel tolerance, same as scaling the distance at which each lod is used
+	/// </summary>
+	float getLodScale() const {
+		return lodScale;
+	}
+
+	unsigned int getDrawRings() const {
+		return drawRings;
+	}
+
+	void fillStats(FrameStats& stats) const;
+
+private:
+	float targetFrameTime;
+	unsigned int maxRings;
+
+	float smoothedFrameTime;
+	float lodScale;
+	unsigned int drawRings;
+	float timeSinceAdjust;
+
+	static constexpr float smoothing = 0.1f; //weight of a new frame in the smoothed frame time
+	static constexpr float deadband = 0.1f; //relative frame time error that is ignored
+	static constexpr float adjustInterval = 0.25f; //seconds between adjustments
+	static constexpr float maxStep = 0.25f; //largest relative change of the lod scale in one adjustment
+	static constexpr float minLodScale = 0.5f, maxLodScale = 4.0f;
+	static constexpr unsigned int minRings = 2;
+};
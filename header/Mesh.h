@@ -1,9 +1,10 @@
 #pragma once
 
-#include <glad/glad.h> 
+#include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
+#include <cstdint>
 
 
 struct Vertex
@@ -13,24 +14,85 @@ struct Vertex
 	glm::vec3 color = glm::vec3{ 0.0f };
 };
 
-class Mesh
+/// <summary>
+/// Packed terrain vertex, 8 bytes instead of the 36 of Vertex.
+/// x & z are reconstructed in vertex.vert from the grid coordinate (in full resolution steps) and the chunk origin / spacing uniforms,
+/// y is quantized between the chunk min and max height and the normal is octahedral encoded. Color is a per chunk uniform.
+/// </summary>
+struct TerrainVertex
+{
+	uint8_t gridX, gridZ;
+	uint8_t flags = 0;
+	uint8_t padding = 0;
+	uint16_t height = 0;
+	int8_t normal[2] = { 0, 0 };
+
+	static constexpr uint8_t skirtFlag = 1;
+};
+static_assert(sizeof(TerrainVertex) == 8, "TerrainVertex must stay 8 bytes");
+
+template<typename V>
+class BasicMesh
 {
 public:
-	std::vector<Vertex> vertices;
+	std::vector<V> vertices;
 	std::vector<unsigned int> indices;
 
-	Mesh() = default;
-	Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices);
+	BasicMesh() = default;
+	/// <summary>
+	/// Upload vertices and indices, the mesh keeps them in RAM until releaseGeometry. Moved in vertices and indices are not copied
+	/// </summary>
+	BasicMesh(std::vector<V> vertices, std::vector<unsigned int> indices);
+	/// <summary>
+	/// Create a mesh that draws from an element buffer shared with other meshes, the buffer is not deleted with this mesh
+	/// </summary>
+	BasicMesh(std::vector<V> vertices, unsigned int sharedEBO);
+
+	/// <summary>
+	/// Give up the copy in RAM once uploaded, the mesh draws from VRAM alone. The vertices are handed back so their storage can be reused
+	/// </summary>
+	std::vector<V> releaseGeometry();
+
+	/// <summary>
+	/// Read the vertices back from VRAM, out must have room for getVertexCount vertices
+	/// </summary>
+	void readVertices(V* out) const;
+
+	unsigned int getVertexCount() const {
+		return nrVertices;
+	}
 
 	/// <summary>
 	/// Remove buffer objects from VRAM
 	/// </summary>
 	void deleteMesh();
-	
+
+	/// <summary>
+	/// Draw from another shared element buffer, only for meshes created with a shared buffer
+	/// </summary>
+	void setElementBuffer(unsigned int sharedEBO);
+
 	void draw(int polygonMode);
+	/// <summary>
+	/// Draw count indices starting at byte offset in the element buffer
+	/// </summary>
+	void draw(int polygonMode, unsigned int count, unsigned int offset);
+	/// <summary>
+	/// Draw up to 32 ranges of the element buffer in one call
+	/// </summary>
+	void draw(int polygonMode, const GLsizei* counts, const unsigned int* offsets, int nrRanges);
 private:
 	unsigned int VAO, VBO, EBO;
+	unsigned int nrVertices = 0, nrIndices = 0; //uploaded, the copies in RAM may be released
 	bool bakedMesh = false;
+	bool ownsEBO = true;
 
 	void setupMesh();
-};
\ No newline at end of file
+	/// <summary>
+	/// Describe the memory layout of V to the currently bound VAO
+	/// </summary>
+	static void setupVertexAttributes();
+};
+
+using Mesh = BasicMesh<Vertex>;
+using TerrainMesh = BasicMesh<TerrainVertex>;
@@ -0,0 +1,45 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+/// <summary>
+/// Low resolution CPU depth buffer for occlusion culling. Occluders are rasterized conservatively, a pixel is only
+/// written when a triangle covers all of it and then with the farthest depth of the triangle, so a box that tests as
+/// occluded is hidden for certain. Depth is the clip space w ie. distance along the view direction
+/// </summary>
+class OcclusionBuffer {
+public:
+	OcclusionBuffer(unsigned int _width, unsigned int _height);
+
+	/// <summary>
+	/// Empty the buffer and set the camera occluders and boxes are projected with
+	/// </summary>
+	void clear(const glm::mat4& _viewProjection);
+
+	/// <summary>
+	/// Rasterize an occluding triangle given in world space, triangles crossing the near plane are skipped
+	/// </summary>
+	void addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+	/// <summary>
+	/// True if the box is behind the occluders in every pixel it covers
+	/// </summary>
+	bool isOccluded(const glm::vec3& min, const glm::vec3& max) const;
+
+private:
+	struct ScreenPoint {
+		float x, y; //pixel coordinates
+		float w; //depth
+	};
+
+	/// <summary>
+	/// Project p to pixel coordinates, returns false if p is behind the near plane
+	/// </summary>
+	bool project(const glm::vec3& p, ScreenPoint& out) const;
+
+	unsigned int width, height;
+	glm::mat4 viewProjection{ 1.0f };
+	std::vector<float> depth;
+
+	static constexpr float nearW = 0.01f;
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+/// <summary>
+/// Bump allocator for the temporary memory of a job. An allocation only moves a pointer forward in a block and is never freed on its own,
+/// Scope gives back everything allocated since it was opened and keeps the blocks. A thread that runs the same kind of job again
+/// therefore takes nothing from the heap once its arena has grown to the largest job. Every thread has its own arena, see local
+/// </summary>
+class ScratchArena {
+public:
+	/// <summary>
+	/// Running totals of an arena
+	/// </summary>
+	struct Counters {
+		unsigned int allocations = 0; //taken from the arena
+		size_t bytes = 0;
+		unsigned int heapAllocations = 0; //blocks the arena took from the heap because the allocations did not fit
+	};
+
+	/// <summary>
+	/// Allocations made while a scope is open are given back when it closes, scopes close in the reverse order they are opened
+	/// </summary>
+	class Scope {
+	public:
+		Scope() : arena{ local() }, block{ arena.current }, offset{ arena.offset }, start{ arena.counters } {}
+		~Scope() {
+			arena.current = block;
+			arena.offset = offset;
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		/// <summary>
+		/// What the arena handed out since the scope was opened, nested scopes included
+		/// </summary>
+		Counters used() const {
+			return { arena.counters.allocations - start.allocations, arena.counters.bytes - start.bytes,
+				arena.counters.heapAllocations - start.heapAllocations };
+		}
+
+	private:
+		ScratchArena& arena;
+		size_t block, offset;
+		Counters start;
+	};
+
+	ScratchArena() = default;
+	~ScratchArena();
+
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	/// <summary>
+	/// Arena of the calling thread
+	/// </summary>
+	static ScratchArena& local();
+
+	void* allocate(size_t size, size_t alignment);
+
+private:
+	struct Block {
+		char* data;
+		size_t size;
+	};
+
+	static constexpr size_t minBlockSize = 1 << 20;
+	std::vector<Block> blocks;
+	size_t current = 0; //block being filled
+	size_t offset = 0; //first free byte in it
+	Counters counters;
+};
+
+/// <summary>
+/// Standard allocator taking memory from the arena of the calling thread, deallocating does nothing.
+/// Containers using it must be filled by the thread that created them and destroyed before the scope they were created in closes
+/// </summary>
+template<typename T>
+struct ScratchAllocator {
+	using value_type = T;
+
+	ScratchAllocator() = default;
+	template<typename U>
+	ScratchAllocator(const ScratchAllocator<U>&) {}
+
+	T* allocate(size_t n) {
+		return static_cast<T*>(ScratchArena::local().allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T*, size_t) {}
+
+	template<typename U>
+	bool operator==(const ScratchAllocator<U>&) const {
+		return true;
+	}
+	template<typename U>
+	bool operator!=(const ScratchAllocator<U>&) const {
+		return false;
+	}
+};
+
+template<typename T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
@@ -29,6 +29,9 @@ public:
 	void setBool(const std::string &name, bool value) const;
 	void setInt(const std::string& name, int value) const;
 	void setFloat(const std::string& name, float value) const;
+	void setVec2(const std::string& name, const glm::vec2& value) const;
+	void setIVec2(const std::string& name, const glm::ivec2& value) const;
+	void setVec3(const std::string& name, const glm::vec3& value) const;
 	void setMat4(const std::string& name, const glm::mat4 value) const;
 
 };
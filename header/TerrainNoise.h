@@ -0,0 +1,115 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cassert>
+#include <utility>
+#include <vector>
+
+/// <summary>
+/// The fbm height function of the terrain, and a cheap conservative estimate of its range over a region.
+/// The estimate lets chunks be culled and ordered before their grid is generated
+/// </summary>
+class TerrainNoise {
+public:
+	/// <summary>
+	/// Terrain height at x, z, never below groundLevel
+	/// </summary>
+	static float height(float x, float z);
+
+	/// <summary>
+	/// Heights in the region x0..x1, z0..z1 lie inside the returned min, max.
+	/// Coarse octaves are bounded per noise lattice cell with interval arithmetic, the rest by their amplitude.
+	/// The bound holds as long as the gradients read back from glm::perlin are within gradientMargin and glm's scale is perlinRange,
+	/// generated chunks assert it in debug builds
+	/// </summary>
+	static std::pair<float, float> estimateHeightRange(float x0, float z0, float x1, float z1);
+
+	/// <summary>
+	/// Highest the terrain can reach anywhere, every octave at its largest
+	/// </summary>
+	static constexpr float maxHeight() {
+		float bound = 0.0f;
+		float amp = amplitude;
+		for (int i = 0; i < octaves; ++i) {
+			bound += amp * perlinRange;
+			amp *= gain;
+		}
+		return bound;
+	}
+
+	/// <summary>
+	/// Estimated largest height error of the terrain drawn between heights sampled step apart, a heuristic that only picks lod ranges.
+	/// Each octave is bounded by its curvature, or by a part of its amplitude once the samples are too far apart to follow it
+	/// </summary>
+	static float interpolationError(float step);
+
+	static constexpr int octaves = 6;
+	static constexpr float seed = 0.1f;
+	static constexpr float amplitude = 6.0f;
+	static constexpr float gain = 0.5f; //How much to increase / decrease each octave
+	static constexpr float lacunarity = 2.0f; //How much to increase / decrease frequency each octave ie. how big steps to take in the noise space
+	static constexpr float frequency = 0.09f;
+	static constexpr float groundLevel = -1.51f;
+
+private:
+	struct CornerRange {
+		float minWeight, maxWeight; //range of the corner's blend weight over a box
+		float low, high; //range of the corner's linear function over the box
+	};
+
+	/// <summary>
+	/// Gradients of the lattice points around a region of one octave, in both w layers
+	/// </summary>
+	struct Lattice {
+		int cellX0, cellZ0, width, depth;
+		std::vector<glm::vec3> gradients;
+
+		const glm::vec3& gradient(int x, int z, int c) const {
+			assert(x >= cellX0 && x < cellX0 + width && z >= cellZ0 && z < cellZ0 + depth && (c == 0 || c == 1));
+			return gradients[(x - cellX0) + width * (z - cellZ0) + width * depth * c];
+		}
+	};
+
+	/// <summary>
+	/// Gradients around the noise space region x0..x1, z0..z1
+	/// </summary>
+	static Lattice makeLattice(float x0, float z0, float x1, float z1);
+
+	/// <summary>
+	/// Bound of one octave of noise over the noise space region x0..x1, z0..z1 at the seed plane, the region must be inside lattice.
+	/// Each lattice cell is split in boxesPerCell x boxesPerCell boxes that are bounded separately
+	/// </summary>
+	static std::pair<float, float> octaveRange(const Lattice& lattice, float x0, float z0, float x1, float z1, int boxesPerCell);
+
+	/// <summary>
+	/// Range of a weighted sum of the 8 corners when the weights sum to 1, reorders corners
+	/// </summary>
+	static std::pair<float, float> blendRange(CornerRange* corners);
+
+	/// <summary>
+	/// Fade curve of the noise, 6t^5 - 15t^4 + 10t^3
+	/// </summary>
+	static float fade(float t) {
+		return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+	}
+
+	/// <summary>
+	/// Gradient of the noise at lattice point x, z, w. Near a lattice point the noise is linear in the gradient,
+	/// the other corners only enter through the fade curves whose first two derivatives are 0, so central differences are exact up to a tiny error
+	/// </summary>
+	static glm::vec3 latticeGradient(int x, int z, int w);
+
+	//Classic perlin noise with gradients of at most unit length is within +-sqrt(3) / 2, glm scales it by 2.2
+	static constexpr float perlinRange = 2.2f * 0.8661f;
+	//Upper bound of the error of the sampled gradients times the largest offset from a corner
+	static constexpr float gradientMargin = 0.005f;
+	//Octaves covering more lattice cells than this per side are bounded by their amplitude
+	static constexpr int maxLatticeCells = 12;
+	//Boxes per lattice cell side the weights and corner functions of the first octave are bounded over, halved every octave
+	static constexpr int subdivisions = 8;
+	//Tiles per side of the region in estimateHeightRange
+	static constexpr int tiles = 8;
+	//Curvature of one octave and its largest error as part of the amplitude in interpolationError,
+	//fitted so the estimate stays above the lod errors of generated chunks
+	static constexpr float octaveCurvature = 3.0f;
+	static constexpr float octaveErrorCap = 0.25f;
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+
+/// <summary>
+/// Fixed set of worker threads that run jobs in the order they are pushed
+/// </summary>
+class WorkerPool {
+public:
+	/// <summary>
+	/// Start the worker threads
+	/// </summary>
+	/// <param name="nrWorkers">number of threads, at least one</param>
+	explicit WorkerPool(unsigned int nrWorkers);
+
+	/// <summary>
+	/// Let running jobs finish, jobs that have not started are dropped
+	/// </summary>
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	/// <summary>
+	/// Run job on the first free worker after the jobs pushed before it have started
+	/// </summary>
+	void push(std::function<void()> job);
+
+	/// <summary>
+	/// Run task(0) .. task(count - 1) on the calling thread and on every worker that is free, returns when all have run.
+	/// Free workers help before starting pushed jobs, so the job calling this finishes first. The calling thread only waits
+	/// for tasks that are already running, so a job may call this from a worker of the same pool. Nothing is allocated,
+	/// heap allocations the tasks make on the workers are charged to the calling thread, see HeapCounter
+	/// </summary>
+	template<typename Task>
+	void parallelFor(unsigned int count, const Task& task) {
+		parallelFor(count, [](const void* task, unsigned int i) { (*static_cast<const Task*>(task))(i); }, &task);
+	}
+
+	unsigned int getWorkers() const {
+		return static_cast<unsigned int>(workers.size());
+	}
+
+	/// <summary>
+	/// One worker per hardware thread except the one drawing
+	/// </summary>
+	static unsigned int defaultWorkers() {
+		return std::max(2u, std::thread::hardware_concurrency()) - 1;
+	}
+
+private:
+	/// <summary>
+	/// Tasks of one parallelFor call, on the stack of the calling thread
+	/// </summary>
+	struct TaskSet {
+		void (*invoke)(const void* task, unsigned int i);
+		const void* task;
+		unsigned int count;
+		std::atomic<unsigned int> next{ 0 };
+		unsigned int done = 0; //guarded by mu
+		unsigned int helpers = 0; //workers asked to help that have not finished, guarded by mu
+		size_t heapAllocations = 0; //made by the helpers while running tasks, guarded by mu
+		std::mutex mu;
+		std::condition_variable finished;
+
+		/// <summary>
+		/// Run tasks that have not started until none is left
+		/// </summary>
+		void runTasks(bool helper);
+	};
+
+	void parallelFor(unsigned int count, void (*invoke)(const void* task, unsigned int i), const void* task);
+
+	/// <summary>
+	/// Worker loop, runs jobs until the pool is destroyed
+	/// </summary>
+	void run();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::deque<TaskSet*> helping; //one entry per worker asked to help, taken before jobs
+	std::mutex mu;
+	std::condition_variable jobPushed;
+	bool stopping = false;
+};
@@ -8,12 +8,15 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <iostream>
+#include <algorithm>
 
 #include "header/Shader.h"
 #include "header/Mesh.h"
 #include "header/CameraControl.h"
 #include "header/ChunkHandler.h"
 #include "header/CameraPlane.h"
+#include "header/LodGovernor.h"
+#include "header/HeapCounter.h"
 
 
 void initialize();
@@ -33,6 +36,8 @@ void printmat4(const glm::mat4& mat);
 int constexpr gridSize{ 17 };
 int constexpr nrVertices{ 161 };
 float constexpr spacing{ 0.075f };
+float constexpr pixelTolerance{ 8.0f }; //max screen space error in pixels when selecting lod
+float constexpr targetFrameTime{ 1.0f / 60.0f }; //frame time the lod governor tries to hold
 
 const unsigned int SCREEN_WIDTH = 1600, SCREEN_HEIGHT = 900;
 
@@ -47,7 +52,7 @@ int lod = 1;
 
 float deltaTime = 0.0f, lastFrame = 0.0f;
 
-bool cull = false, useLOD = true, wireFrame = false, drawbb = false;
+bool cull = false, useLOD = true, wireFrame = false, drawbb = false, stitchEdges = false, useGovernor = false, temporalCulling = true, occlusionCulling = false, patchCulling = true, adaptiveMeshing = false, cdlod = false, farField = false;
 
 int main() {
 
@@ -83,7 +88,9 @@ int main() {
     Shader cameraShader{ "shaders/cameraVertex.vert", "shaders/cameraFragment.frag" };
     Shader boundingBoxShader{ "shaders/boundingBoxVertex.vert", "shaders/boundingBoxFragment.frag" };
 
-    glm::mat4 perspective = glm::perspective(glm::radians(45.0f), static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT, 1.0f, 70.0f);
+    float fov = glm::radians(45.0f);
+    float constexpr farPlane{ 70.0f };
+    glm::mat4 perspective = glm::perspective(fov, static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT, 1.0f, farPlane);
     glm::mat4 perspective2 = glm::perspective(glm::radians(45.0f), static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT, 0.1f, 100.0f);
 
     /*** Always use the larger perspective to render camera frustum, otherwise it risk being culled in viewport ***/
@@ -107,7 +114,12 @@ int main() {
     Mesh camera1Mesh{ campoints, camIndices };
 
     //65
+    float startTime = glfwGetTime();
+    float firstFrameTime = -1.0f;
     ChunkHandler chandler{gridSize, nrVertices, spacing , 1.8f };   // (gridSize, nrVertices, spacing, yScale)
+    chandler.setProjection(fov, SCREEN_HEIGHT);
+    chandler.setPixelTolerance(pixelTolerance);
+    LodGovernor governor{ targetFrameTime, gridSize / 2 };
 
     //OpenGL render Settings
     glEnable(GL_DEPTH_TEST);
@@ -118,6 +130,18 @@ int main() {
     *****************/
 
     float timer{ 0.0f };
+
+    //Count terrain fragments that pass the depth test to compare overdraw between skirts and stitched edges.
+    //The queries are used in turn and a result is only read once the GPU has it, so the CPU never waits for the terrain pass
+    const int nrFragmentQueries = 3;
+    unsigned int fragmentQueries[nrFragmentQueries];
+    bool fragmentQueryIssued[nrFragmentQueries] = {};
+    int fragmentQuery = 0;
+    glGenQueries(nrFragmentQueries, fragmentQueries);
+    unsigned int terrainFragments{ 0 };
+
+    //Worker time of the chunk jobs and adaptive index builds since start, the title shows the time each took on average
+    FrameStats jobTotals;
     
     while (!glfwWindowShouldClose(window))
     {
@@ -125,9 +149,44 @@ int main() {
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        //trade quality for frame time
+        if (useGovernor)
+            governor.update(deltaTime);
+        else
+            governor.reset();
+        chandler.setLodScale(governor.getLodScale());
+        chandler.setDrawRings(governor.getDrawRings());
+
         //display fps
         if (timer <= 0.0f) {
-            std::string title = "fps: " + std::to_string(1.0f / deltaTime);
+            FrameStats stats = chandler.getStats();
+            governor.fillStats(stats);
+            std::string title = "fps: " + std::to_string(1.0f / deltaTime) + "  triangles: " + std::to_string(stats.triangles) +
+                " (skirts: " + std::to_string(stats.skirtTriangles) + ")  overdraw: " + std::to_string(static_cast<float>(terrainFragments) / (SCREEN_WIDTH * SCREEN_HEIGHT)) +
+                "  plane tests: " + std::to_string(stats.cullPlaneTests) + "  occluded: " + std::to_string(stats.chunksOccluded) +
+                "  resident chunks: " + std::to_string(stats.chunksResident) + " (coarse: " + std::to_string(stats.chunksCoarse) + ", allocated: " +
+                std::to_string(stats.chunksAllocated) + ")";
+            //startup and jumps (X), full grid counts until every chunk around the camera was added
+            if (firstFrameTime >= 0.0f)
+                title += "  first frame: " + std::to_string(firstFrameTime * 1000.0f) + " ms";
+            title += "  full grid: " + (stats.fillTime < 0.0f ? std::string{ "filling" } : std::to_string(stats.fillTime * 1000.0f) + " ms");
+            //per chunk job since start
+            unsigned int jobs = std::max(jobTotals.jobsFinished, 1u);
+            title += "  chunk jobs: " + std::to_string(jobTotals.jobsFinished) + "  scratch per job: " +
+                std::to_string(jobTotals.jobScratchAllocations / jobs) + " (" + std::to_string(jobTotals.jobScratchBytes / jobs / 1024) + " KB)  arena blocks: " +
+                std::to_string(jobTotals.jobArenaBlocks);
+            if (HeapCounter::enabled)
+                title += "  heap per job: " + std::to_string(static_cast<float>(jobTotals.jobHeapAllocations) / jobs);
+            if (cdlod)
+                title += "  cdlod nodes: " + std::to_string(stats.cdlodNodes) + "  draw calls: " + std::to_string(stats.drawCalls);
+            if (farField)
+                title += "  far field triangles: " + std::to_string(stats.farFieldTriangles) + "  heights: " + std::to_string(stats.farFieldHeights);
+            if (adaptiveMeshing)
+                title += "  adaptive pending: " + std::to_string(stats.adaptivePending) + "  adaptive build: " +
+                    std::to_string(jobTotals.adaptiveBuildTime * 1000.0f / std::max(jobTotals.adaptiveBuilds, 1u)) + " ms  chunk job: " +
+                    std::to_string(jobTotals.jobTime * 1000.0f / std::max(jobTotals.jobsFinished, 1u)) + " ms";
+            if (useGovernor)
+                title += "  lod scale: " + std::to_string(stats.lodScale) + "  rings: " + std::to_string(stats.drawRings);
             glfwSetWindowTitle(window, title.c_str());
             timer = 0.1f;
         }
@@ -142,6 +201,10 @@ int main() {
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        //The far field is only seen if the far plane moves out with it
+        chandler.useFarField(farField);
+        perspective = glm::perspective(fov, static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT, 1.0f, farField ? chandler.getFarFieldReach() : farPlane);
+
         glm::mat4 camera1 = camera1Control.computeCameraViewMatrix();
         glm::mat4 modelM = glm::mat4(1.0f);
 
@@ -163,6 +226,9 @@ int main() {
         auto planes = computeCameraPlanes(worldCamPoints);
 
         /*** Cull terrain ***/
+        chandler.useTemporalCoherence(temporalCulling);
+        chandler.usePatchCulling(patchCulling);
+        chandler.useOcclusionCulling(occlusionCulling, perspective * camera1);
         if (cull) {
             chandler.cullTerrain(cull);
         }
@@ -184,20 +250,48 @@ int main() {
         if(glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS)
             myShader.setBool("colorDistance", false);
 
+        chandler.useEdgeStitching(stitchEdges);
+        chandler.useAdaptiveMeshing(adaptiveMeshing);
+        chandler.useCdlod(cdlod);
+        //A query still in flight is not reused, the frame is not counted then
+        bool countFragments = true;
+        if (fragmentQueryIssued[fragmentQuery]) {
+            unsigned int available = 0;
+            glGetQueryObjectuiv(fragmentQueries[fragmentQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+                glGetQueryObjectuiv(fragmentQueries[fragmentQuery], GL_QUERY_RESULT, &terrainFragments);
+            countFragments = available != 0;
+        }
+        if (countFragments)
+            glBeginQuery(GL_SAMPLES_PASSED, fragmentQueries[fragmentQuery]);
         if (wireFrame) {
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
             if (useLOD)
-                chandler.draw(camera1Control.getCameraPosition());
+                chandler.draw(camera1Control.getCameraPosition(), myShader);
             else
-                chandler.drawWithoutLOD();
+                chandler.drawWithoutLOD(camera1Control.getCameraPosition(), myShader);
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
         else {
             if (useLOD)
-                chandler.draw(camera1Control.getCameraPosition());
+                chandler.draw(camera1Control.getCameraPosition(), myShader);
             else
-                chandler.drawWithoutLOD();
+                chandler.drawWithoutLOD(camera1Control.getCameraPosition(), myShader);
+        }
+        if (countFragments) {
+            glEndQuery(GL_SAMPLES_PASSED);
+            fragmentQueryIssued[fragmentQuery] = true;
+            fragmentQuery = (fragmentQuery + 1) % nrFragmentQueries;
         }
+        const FrameStats& frameStats = chandler.getStats();
+        jobTotals.jobsFinished += frameStats.jobsFinished;
+        jobTotals.jobTime += frameStats.jobTime;
+        jobTotals.jobScratchAllocations += frameStats.jobScratchAllocations;
+        jobTotals.jobScratchBytes += frameStats.jobScratchBytes;
+        jobTotals.jobArenaBlocks += frameStats.jobArenaBlocks;
+        jobTotals.jobHeapAllocations += frameStats.jobHeapAllocations;
+        jobTotals.adaptiveBuilds += frameStats.adaptiveBuilds;
+        jobTotals.adaptiveBuildTime += frameStats.adaptiveBuildTime;
 
         /*** Draw bounding boxes around chunks  ***/
         boundingBoxShader.use();
@@ -208,6 +302,8 @@ int main() {
             chandler.drawBoundingBox();
 
         glfwSwapBuffers(window);
+        if (firstFrameTime < 0.0f)
+            firstFrameTime = glfwGetTime() - startTime;
         glfwPollEvents();
     }
 
@@ -342,6 +438,35 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if (key == GLFW_KEY_L && action == GLFW_PRESS) {
         useLOD = !useLOD;
     }
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        stitchEdges = !stitchEdges;
+    }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        useGovernor = !useGovernor;
+    }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        temporalCulling = !temporalCulling;
+    }
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        occlusionCulling = !occlusionCulling;
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        patchCulling = !patchCulling;
+    }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        adaptiveMeshing = !adaptiveMeshing;
+    }
+    if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+        cdlod = !cdlod;
+    }
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        farField = !farField;
+    }
+    //Jump far away and time how long it takes until the chunks around the new position are there
+    if (key == GLFW_KEY_X && action == GLFW_PRESS) {
+        camera1Control.setCameraPosition(camera1Control.getCameraPosition() + glm::vec3{ 1000.0f, 0.0f, 0.0f });
+        updateCamera2();
+    }
 
   
 }
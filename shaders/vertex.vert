@@ -1,16 +1,122 @@
 #version 330 core
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 color;
+layout (location = 0) in uvec3 grid; //grid x, grid z and flags
+layout (location = 1) in float height; //normalized between chunk min and max height
+layout (location = 2) in vec2 octNormal; //octahedral encoded normal
+layout (location = 3) in vec4 nodeChunk; //CDLOD node: chunk origin x, z and chunk min, max height
+layout (location = 4) in ivec4 node; //CDLOD node: first grid coordinate x, z in the chunk, lod level, height map layer
 
 out vec3 o_normal;
 out vec3 pos;
 out vec3 o_color;
 
 uniform mat4 M,V,P;
+uniform vec2 chunkOrigin; //x,z of the first vertex in the chunk
+uniform float gridSpacing; //distance between full resolution vertices
+uniform vec2 heightRange; //min and max height of the chunk
+uniform float skirtDepth;
+uniform vec3 lodColor;
+
+//CDLOD, grid is the vertex in the shared grid patch and heights come from the packed chunk vertices in heightMap
+uniform bool cdlod;
+uniform usampler2DArray heightMap; //one layer per chunk, texel = packed vertex
+uniform vec2 morphRanges[5]; //distance where morphing to the next coarser lod starts and ends, per lod level
+uniform vec3 lodColors[5];
+uniform vec3 camPos;
+
+//Geometry clipmap far field, grid is the vertex in the window of one level and heights come from that level's layer of clipmapHeights
+uniform bool clipmap;
+uniform sampler2DArray clipmapHeights; //one layer per level, addressed toroidally by lattice coordinate
+uniform int clipmapLevel;
+uniform int clipmapCells; //cells per window side
+uniform ivec2 clipmapOrigin; //lattice coordinate of the first vertex in the window, in level steps
+uniform ivec2 clipmapTexel; //texel of clipmapOrigin
+uniform vec2 clipmapAnchor; //x, z of lattice coordinate 0
+uniform float clipmapSpacing; //lattice spacing of the finest level
+
+const uint skirtFlag = 1u;
+
+vec3 decodeNormal(vec2 e) {
+	vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+	if(n.y < 0.0)
+		n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+float unpackSnorm(uint b) {
+	return max(float(int(b) - (b > 127u ? 256 : 0)) / 127.0, -1.0);
+}
+
+//Height and normal of full resolution vertex g of the node's chunk, the first row and column are skirts
+void fetchVertex(ivec2 g, out float y, out vec3 normal) {
+	uvec4 texel = texelFetch(heightMap, ivec3(g + 1, node.w), 0);
+	y = mix(nodeChunk.z, nodeChunk.w, float(texel.b) / 65535.0);
+	normal = decodeNormal(vec2(unpackSnorm(texel.a & 0xFFu), unpackSnorm(texel.a >> 8)));
+}
+
+//Height of window vertex i of the current clipmap level, clamped to the window
+float clipmapHeight(ivec2 i) {
+	ivec2 texel = (clipmapTexel + clamp(i, ivec2(0), ivec2(clipmapCells))) % (clipmapCells + 1);
+	return texelFetch(clipmapHeights, ivec3(texel, clipmapLevel), 0).r;
+}
+
 void main() {
+	vec3 position;
+	vec3 normal;
+	if(cdlod) {
+		int step = 1 << node.z;
+		ivec2 g = node.xy + ivec2(grid.xy) * step;
+		fetchVertex(g, position.y, normal);
+		position.xz = nodeChunk.xy + vec2(g) * gridSpacing;
+
+		//Vertices on odd rows / columns of the node's lod slide onto the coarser lod's vertex, which makes the grid that coarser lod at morph = 1
+		float morph = clamp((distance(camPos, position) - morphRanges[node.z].x) / (morphRanges[node.z].y - morphRanges[node.z].x), 0.0, 1.0);
+		ivec2 coarse = g - ((g / step) & 1) * step;
+		float coarseY;
+		vec3 coarseNormal;
+		fetchVertex(coarse, coarseY, coarseNormal);
+		position = mix(position, vec3(nodeChunk.x + coarse.x * gridSpacing, coarseY, nodeChunk.y + coarse.y * gridSpacing), morph);
+		normal = normalize(mix(normal, coarseNormal, morph));
+		o_color = lodColors[node.z];
+
+		//Skirt vertices hang below their side only where it is a side of the chunk, anywhere else they stay on the edge
+		if((grid.z & skirtFlag) != 0u) {
+			int chunkCells = textureSize(heightMap, 0).x - 3;
+			uint side = (grid.z >> 1) & 3u; //north, south, west, east
+			bool chunkSide = side == 0u ? g.y == 0 : side == 1u ? g.y == chunkCells : side == 2u ? g.x == 0 : g.x == chunkCells;
+			if(chunkSide) {
+				position.y = skirtDepth;
+				o_color = vec3(1.0, 0.0, 1.0);
+			}
+		}
+	}
+	else if(clipmap) {
+		ivec2 i = ivec2(grid.xy);
+		position.y = clipmapHeight(i);
+		//Every other vertex on the outer border lies halfway along an edge of the next coarser level and takes its height there, so the levels meet without cracks
+		if((i.x == 0 || i.x == clipmapCells) && (i.y & 1) == 1)
+			position.y = 0.5 * (clipmapHeight(i - ivec2(0, 1)) + clipmapHeight(i + ivec2(0, 1)));
+		if((i.y == 0 || i.y == clipmapCells) && (i.x & 1) == 1)
+			position.y = 0.5 * (clipmapHeight(i - ivec2(1, 0)) + clipmapHeight(i + ivec2(1, 0)));
+		//From the integer lattice coordinate so vertices shared by two levels end up at the same place
+		position.xz = clipmapAnchor + vec2((clipmapOrigin + i) * (1 << clipmapLevel)) * clipmapSpacing;
+		float step = float(1 << clipmapLevel) * clipmapSpacing;
+		normal = normalize(vec3(clipmapHeight(i - ivec2(1, 0)) - clipmapHeight(i + ivec2(1, 0)), 2.0 * step,
+			clipmapHeight(i - ivec2(0, 1)) - clipmapHeight(i + ivec2(0, 1))));
+		o_color = lodColor;
+		if((grid.z & skirtFlag) != 0u) {
+			position.y = skirtDepth;
+			o_color = vec3(1.0, 0.0, 1.0);
+		}
+	}
+	else {
+		bool skirt = (grid.z & skirtFlag) != 0u;
+		position.xz = chunkOrigin + vec2(grid.xy) * gridSpacing;
+		position.y = skirt ? skirtDepth : mix(heightRange.x, heightRange.y, height);
+		normal = decodeNormal(octNormal);
+		o_color = skirt ? vec3(1.0, 0.0, 1.0) : lodColor;
+	}
+
 	gl_Position = P * V * M * vec4(position, 1.0);
 	pos = vec3(M * vec4(position, 1.0));
-	o_normal = mat3(M) * normal; //upper left 3x3 matrix of mv matrix 
-	o_color = color;
-}
\ No newline at end of file
+	o_normal = mat3(M) * normal; //upper left 3x3 matrix of mv matrix
+}
@@ -0,0 +1,252 @@
+#include "..\header\AdaptiveIndexBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <utility>
+
+AdaptiveIndexBuffer::AdaptiveIndexBuffer(const float* heights, unsigned int _nrVertices, unsigned int _maxLod, unsigned int _patchesPerSide, const float* lodErrors,
+	WorkerPool* pool)
+	: nrVertices{ _nrVertices + 2 }, patchesPerSide{ _patchesPerSide }, patchSpan{ (_nrVertices - 1) / _patchesPerSide }
+{
+	unsigned int patches = patchesPerSide * patchesPerSide;
+	auto forEachPatch = [&](const auto& task) {
+		if (pool != nullptr)
+			pool->parallelFor(patches, task);
+		else
+			for (unsigned int patch = 0; patch < patches; ++patch)
+				task(patch);
+	};
+
+	//All scratch is allocated here, the helping workers only write to their patch
+	ScratchArena::Scope scratch;
+	size_t patchSize = (patchSpan + 1) * (patchSpan + 1);
+	ScratchVector<float> patchErrors(patches * patchSize);
+	forEachPatch([&](unsigned int patch) {
+		computeErrors(heights, patch % patchesPerSide, patch / patchesPerSide, &patchErrors[patch * patchSize]);
+	});
+
+	//The errors of every patch are constrained in parallel, the triangles are added in patch order
+	ScratchVector<float> errors(patches * patchSize);
+	ScratchVector<unsigned char> fixed(patches * patchSize);
+	for (unsigned int lod = 1; lod <= _maxLod; lod *= 2) {
+		unsigned int level = ChunkIndexBuffer::lodLevel(lod);
+		float maxError = level == 0 ? lodErrors[1] / 2.0f : lodErrors[level];
+		forEachPatch([&](unsigned int patch) {
+			std::copy_n(&patchErrors[patch * patchSize], patchSize, &errors[patch * patchSize]);
+			constrainErrors(&errors[patch * patchSize], &fixed[patch * patchSize], lod);
+		});
+
+		LodSet set;
+		set.all = Range{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+		for (unsigned int patch = 0; patch < patches; ++patch) {
+			Range range{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+			unsigned int px = patch % patchesPerSide, pz = patch / patchesPerSide;
+			//The patch square is split along its diagonal into the two root triangles
+			addTriangle(&errors[patch * patchSize], maxError, px, pz, 0, 0, patchSpan, patchSpan, patchSpan, 0);
+			addTriangle(&errors[patch * patchSize], maxError, px, pz, patchSpan, patchSpan, 0, 0, 0, patchSpan);
+			range.count = static_cast<unsigned int>(indices.size()) - range.offset / sizeof(unsigned int);
+			set.patches.push_back(range);
+		}
+		set.skirts = Range{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+		addSkirts(lod);
+		set.skirts.count = static_cast<unsigned int>(indices.size()) - set.skirts.offset / sizeof(unsigned int);
+		set.all.count = static_cast<unsigned int>(indices.size()) - set.all.offset / sizeof(unsigned int);
+		lods.push_back(set);
+	}
+}
+
+void AdaptiveIndexBuffer::bake()
+{
+	glGenBuffers(1, &EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	baked = true;
+	std::vector<unsigned int>().swap(indices);
+}
+
+void AdaptiveIndexBuffer::deleteBuffer()
+{
+	if (baked) {
+		glDeleteBuffers(1, &EBO);
+		baked = false;
+	}
+}
+
+const std::vector<unsigned char>& AdaptiveIndexBuffer::triangleCoordinates(unsigned int patchSpan)
+{
+	//Chunks are triangulated on worker threads
+	static std::mutex mu;
+	static std::map<unsigned int, std::vector<unsigned char>> cache;
+	std::lock_guard<std::mutex> lock(mu);
+	std::vector<unsigned char>& coords = cache[patchSpan];
+	if (!coords.empty())
+		return coords;
+
+	//Triangle i has id i + 2, the bits of the id after the leading one pick the left or right child on the way down from the root triangles
+	unsigned int nrTriangles = patchSpan * patchSpan * 2 - 2;
+	coords.resize(nrTriangles * 4);
+	for (unsigned int i = 0; i < nrTriangles; ++i) {
+		unsigned int id = i + 2;
+		unsigned int ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+		if (id & 1) {
+			bx = by = cx = patchSpan; //bottom left root triangle
+		}
+		else {
+			ax = ay = cy = patchSpan; //top right root triangle
+		}
+		while ((id >>= 1) > 1) {
+			unsigned int mx = (ax + bx) / 2, my = (ay + by) / 2;
+			if (id & 1) { //left child
+				bx = ax;
+				by = ay;
+				ax = cx;
+				ay = cy;
+			}
+			else { //right child
+				ax = bx;
+				ay = by;
+				bx = cx;
+				by = cy;
+			}
+			cx = mx;
+			cy = my;
+		}
+		coords[i * 4 + 0] = static_cast<unsigned char>(ax);
+		coords[i * 4 + 1] = static_cast<unsigned char>(ay);
+		coords[i * 4 + 2] = static_cast<unsigned char>(bx);
+		coords[i * 4 + 3] = static_cast<unsigned char>(by);
+	}
+	return coords;
+}
+
+void AdaptiveIndexBuffer::computeErrors(const float* heights, unsigned int px, unsigned int pz, float* errors) const
+{
+	const std::vector<unsigned char>& coords = triangleCoordinates(patchSpan);
+	unsigned int size = patchSpan + 1;
+	unsigned int rowLength = nrVertices - 2;
+	auto height = [&](int x, int y) { return heights[(px * patchSpan + x) + rowLength * (pz * patchSpan + y)]; };
+
+	//The error of a triangle is the largest distance from its plane to any full resolution vertex inside it,
+	//the two triangles sharing a hypotenuse are split together and store the larger error at its midpoint
+	std::fill_n(errors, size * size, 0.0f);
+	for (size_t i = 0; i < coords.size() / 4; ++i) {
+		int ax = coords[i * 4 + 0], ay = coords[i * 4 + 1], bx = coords[i * 4 + 2], by = coords[i * 4 + 3];
+		int mx = (ax + bx) / 2, my = (ay + by) / 2;
+		int cx = mx + my - ay, cy = my + ax - mx;
+		float ha = height(ax, ay), hb = height(bx, by), hc = height(cx, cy);
+		//Barycentric weights of b and c, twice the signed area keeps them integer until the division
+		int area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+		float error = 0.0f;
+		for (int y = std::min({ ay, by, cy }); y <= std::max({ ay, by, cy }); ++y) {
+			for (int x = std::min({ ax, bx, cx }); x <= std::max({ ax, bx, cx }); ++x) {
+				int wb = (x - ax) * (cy - ay) - (y - ay) * (cx - ax);
+				int wc = (bx - ax) * (y - ay) - (by - ay) * (x - ax);
+				int wa = area - wb - wc;
+				if ((area > 0 && (wa < 0 || wb < 0 || wc < 0)) || (area < 0 && (wa > 0 || wb > 0 || wc > 0)))
+					continue;
+				float plane = (wa * ha + wb * hb + wc * hc) / area;
+				error = std::max(error, std::abs(plane - height(x, y)));
+			}
+		}
+		float& midpointError = errors[mx + size * my];
+		midpointError = std::max(midpointError, error);
+	}
+}
+
+void AdaptiveIndexBuffer::constrainErrors(float* errors, unsigned char* fixed, unsigned int lod) const
+{
+	const std::vector<unsigned char>& coords = triangleCoordinates(patchSpan);
+	unsigned int size = patchSpan + 1;
+	unsigned int nrTriangles = static_cast<unsigned int>(coords.size() / 4);
+	unsigned int nrParents = nrTriangles - patchSpan * patchSpan;
+	std::fill_n(fixed, size * size, 0);
+
+	//Hypotenuses on the patch sides are split down to lod steps, the same vertices as the regular lod grid
+	for (unsigned int i = 0; i < nrTriangles; ++i) {
+		unsigned int ax = coords[i * 4 + 0], ay = coords[i * 4 + 1], bx = coords[i * 4 + 2], by = coords[i * 4 + 3];
+		unsigned int mx = (ax + bx) / 2, my = (ay + by) / 2;
+		if (mx == 0 || my == 0 || mx == patchSpan || my == patchSpan) {
+			unsigned int length = (ax > bx ? ax - bx : bx - ax) + (ay > by ? ay - by : by - ay);
+			errors[mx + size * my] = length > lod ? std::numeric_limits<float>::max() : 0.0f;
+			fixed[mx + size * my] = 1;
+		}
+	}
+
+	auto children = [&](unsigned int i, unsigned int& middle, unsigned int& left, unsigned int& right) {
+		unsigned int ax = coords[i * 4 + 0], ay = coords[i * 4 + 1], bx = coords[i * 4 + 2], by = coords[i * 4 + 3];
+		unsigned int mx = (ax + bx) / 2, my = (ay + by) / 2;
+		unsigned int cx = mx + my - ay, cy = my + ax - mx;
+		middle = mx + size * my;
+		left = (ax + cx) / 2 + size * ((ay + cy) / 2);
+		right = (bx + cx) / 2 + size * ((by + cy) / 2);
+	};
+
+	//Finest first, a triangle is split whenever one of its children is
+	for (unsigned int i = nrParents; i-- > 0;) {
+		unsigned int middle, left, right;
+		children(i, middle, left, right);
+		if (!fixed[middle])
+			errors[middle] = std::max({ errors[middle], errors[left], errors[right] });
+	}
+	//Coarsest first, children of a side triangle that is never split can not be split either
+	for (unsigned int i = 0; i < nrParents; ++i) {
+		unsigned int middle, left, right;
+		children(i, middle, left, right);
+		errors[left] = std::min(errors[left], errors[middle]);
+		errors[right] = std::min(errors[right], errors[middle]);
+	}
+}
+
+void AdaptiveIndexBuffer::addTriangle(const float* errors, float maxError, unsigned int px, unsigned int pz,
+	unsigned int ax, unsigned int ay, unsigned int bx, unsigned int by, unsigned int cx, unsigned int cy)
+{
+	unsigned int mx = (ax + bx) / 2, my = (ay + by) / 2;
+	unsigned int legLength = (ax > cx ? ax - cx : cx - ax) + (ay > cy ? ay - cy : cy - ay);
+	if (legLength > 1 && errors[mx + (patchSpan + 1) * my] > maxError) {
+		addTriangle(errors, maxError, px, pz, cx, cy, ax, ay, mx, my);
+		addTriangle(errors, maxError, px, pz, bx, by, cx, cy, mx, my);
+		return;
+	}
+
+	//Patch coordinates to the skirted full resolution grid
+	auto gridIndex = [&](unsigned int x, unsigned int y) {
+		return (px * patchSpan + x + 1) + nrVertices * (pz * patchSpan + y + 1);
+	};
+	addIndices(gridIndex(ax, ay), gridIndex(bx, by), gridIndex(cx, cy));
+}
+
+void AdaptiveIndexBuffer::addIndices(unsigned int a, unsigned int b, unsigned int c)
+{
+	int ax = a % nrVertices, az = a / nrVertices;
+	int bx = b % nrVertices, bz = b / nrVertices;
+	int cx = c % nrVertices, cz = c / nrVertices;
+	if ((bz - az) * (cx - ax) - (bx - ax) * (cz - az) < 0)
+		std::swap(b, c);
+
+	indices.push_back(a);
+	indices.push_back(b);
+	indices.push_back(c);
+}
+
+void AdaptiveIndexBuffer::addSkirts(unsigned int lod)
+{
+	unsigned int span = nrVertices - 3; //chunk width in full resolution steps
+	unsigned int last = nrVertices - 1;
+	for (unsigned int t = 0; t < span; t += lod) {
+		unsigned int t0 = t + 1, t1 = t + lod + 1;
+		//north, south, west, east: edge vertices one step in from the skirt
+		unsigned int edges[4][4] = {
+			{ t0 + nrVertices, t1 + nrVertices, t0, t1 },
+			{ t0 + nrVertices * (last - 1), t1 + nrVertices * (last - 1), t0 + nrVertices * last, t1 + nrVertices * last },
+			{ 1 + nrVertices * t0, 1 + nrVertices * t1, nrVertices * t0, nrVertices * t1 },
+			{ last - 1 + nrVertices * t0, last - 1 + nrVertices * t1, last + nrVertices * t0, last + nrVertices * t1 }
+		};
+		for (auto& side : edges) {
+			addIndices(side[0], side[1], side[2]);
+			addIndices(side[2], side[1], side[3]);
+		}
+	}
+}
@@ -108,3 +108,8 @@ glm::vec3 CameraControl::getCameraPosition() const
     //return glm::vec3(translation * glm::vec4(position, 1.0f));
     return position;
 }
+
+void CameraControl::setCameraPosition(const glm::vec3& pos)
+{
+    position = pos;
+}
@@ -0,0 +1,289 @@
+#include "..\header\CdlodTerrain.h"
+#include "..\header\ChunkIndexBuffer.h"
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+
+CdlodTerrain::CdlodTerrain(unsigned int _nrVertices, float _spacing, unsigned int maxChunks, const std::vector<TerrainVertex>& flatVertices)
+	: nrVertices{ _nrVertices }, patchCells{ (_nrVertices - 1) >> (levels - 1) }, spacing{ _spacing }
+{
+	//Grid patch of the finest lod, vertices only hold their grid coordinate in the patch
+	unsigned int size = patchCells + 1, half = patchCells / 2;
+	std::vector<TerrainVertex> patch;
+	for (unsigned int z = 0; z < size; ++z) {
+		for (unsigned int x = 0; x < size; ++x) {
+			TerrainVertex v;
+			v.gridX = static_cast<uint8_t>(x);
+			v.gridZ = static_cast<uint8_t>(z);
+			patch.push_back(v);
+		}
+	}
+	//Skirt vertices below the patch sides and below the sides of the first quarter. vertex.vert only lowers them on chunk sides,
+	//elsewhere neighboring nodes meet exactly and the skirts collapse
+	unsigned int skirtLines[4][2] = { { 0, 0 }, { half, patchCells }, { 0, 0 }, { half, patchCells } };
+	unsigned int skirtStart[4][2];
+	for (unsigned int side = ChunkIndexBuffer::north; side <= ChunkIndexBuffer::east; ++side) {
+		for (unsigned int line = 0; line < 2; ++line) {
+			skirtStart[side][line] = static_cast<unsigned int>(patch.size());
+			if (line == 1 && skirtLines[side][1] == skirtLines[side][0])
+				continue;
+			for (unsigned int t = 0; t < size; ++t) {
+				TerrainVertex v;
+				bool row = side == ChunkIndexBuffer::north || side == ChunkIndexBuffer::south;
+				v.gridX = static_cast<uint8_t>(row ? t : skirtLines[side][line]);
+				v.gridZ = static_cast<uint8_t>(row ? skirtLines[side][line] : t);
+				v.flags = static_cast<uint8_t>(TerrainVertex::skirtFlag | (side << 1));
+				patch.push_back(v);
+			}
+		}
+	}
+	auto addSkirt = [&](ChunkIndexBuffer::Side side, unsigned int line, unsigned int first, unsigned int last) {
+		unsigned int p = skirtLines[side][line];
+		for (unsigned int t = first; t < last; ++t) {
+			unsigned int skirt = skirtStart[side][line] + t;
+			switch (side) {
+			case ChunkIndexBuffer::north:
+				addCell(skirt, t + size * p, t + 1 + size * p, skirt + 1);
+				break;
+			case ChunkIndexBuffer::south:
+				addCell(t + size * p, skirt, skirt + 1, t + 1 + size * p);
+				break;
+			case ChunkIndexBuffer::west:
+				addCell(skirt, skirt + 1, p + size * (t + 1), p + size * t);
+				break;
+			case ChunkIndexBuffer::east:
+				addCell(p + size * t, p + size * (t + 1), skirt + 1, skirt);
+				break;
+			}
+		}
+	};
+
+	//Quarter nodes draw the first quarter with its skirts, full nodes everything but the inner skirts of the quarter
+	unsigned int quarterStart = static_cast<unsigned int>(indices.size());
+	addSkirt(ChunkIndexBuffer::south, 0, 0, half);
+	addSkirt(ChunkIndexBuffer::east, 0, 0, half);
+	unsigned int fullStart = static_cast<unsigned int>(indices.size());
+	addSkirt(ChunkIndexBuffer::north, 0, 0, half);
+	addSkirt(ChunkIndexBuffer::west, 0, 0, half);
+	addCells(half, 0);
+	quarter = Range{ static_cast<unsigned int>(quarterStart * sizeof(unsigned int)), static_cast<unsigned int>(indices.size()) - quarterStart };
+	addCells(patchCells, half);
+	addSkirt(ChunkIndexBuffer::north, 0, half, patchCells);
+	addSkirt(ChunkIndexBuffer::west, 0, half, patchCells);
+	addSkirt(ChunkIndexBuffer::south, 1, 0, patchCells);
+	addSkirt(ChunkIndexBuffer::east, 1, 0, patchCells);
+	full = Range{ static_cast<unsigned int>(fullStart * sizeof(unsigned int)), static_cast<unsigned int>(indices.size()) - fullStart };
+
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &EBO);
+	glGenBuffers(1, &instanceVBO);
+
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, patch.size() * sizeof(TerrainVertex), &patch[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribIPointer(0, 3, GL_UNSIGNED_BYTE, sizeof(TerrainVertex), (void*)0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(4);
+	glVertexAttribDivisor(4, 1);
+	glBindVertexArray(0);
+	std::vector<unsigned int>().swap(indices);
+
+	//Packed vertices are 8 bytes, ie. one texel of four 16 bit integers
+	size = nrVertices + 2;
+	glGenTextures(1, &heightTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16UI, size, size, maxChunks + 1, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, flatLayer, size, size, 1, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, &flatVertices[0]);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glGenFramebuffers(1, &readFBO);
+	for (unsigned int layer = maxChunks; layer > flatLayer; --layer)
+		freeLayers.push_back(layer);
+
+	setRanges(1.0f, 1.0f);
+}
+
+void CdlodTerrain::deleteBuffers()
+{
+	if (VAO != 0) {
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		glDeleteBuffers(1, &instanceVBO);
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteTextures(1, &heightTexture);
+		glDeleteFramebuffers(1, &readFBO);
+		VAO = 0;
+	}
+}
+
+unsigned int CdlodTerrain::uploadChunk(const TerrainVertex* vertices)
+{
+	assert(!freeLayers.empty() && "CdlodTerrain::uploadChunk: maxChunks is too small");
+	if (freeLayers.empty())
+		return flatLayer;
+	unsigned int layer = freeLayers.back();
+	freeLayers.pop_back();
+
+	unsigned int size = nrVertices + 2;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, size, size, 1, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, vertices);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return layer;
+}
+
+void CdlodTerrain::readChunk(unsigned int layer, TerrainVertex* vertices) const
+{
+	GLint previous = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous);
+	unsigned int size = nrVertices + 2;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, heightTexture, 0, layer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, size, size, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, vertices);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previous);
+}
+
+void CdlodTerrain::releaseChunk(unsigned int layer)
+{
+	if (layer != flatLayer)
+		freeLayers.push_back(layer);
+}
+
+void CdlodTerrain::setRanges(float pixelsPerUnit, float cellPixels)
+{
+	//A cell of lod level l is 2^l * spacing wide and covers cellPixels pixels at distance 2^l * spacing * pixelsPerUnit / cellPixels.
+	//A node must also stay well within the morph area of its parent's range, or it could meet a coarser node before it is fully morphed
+	constexpr float morphStart = 0.7f; //part of the range that is not morphed
+	float previous = 0.0f;
+	for (unsigned int level = 0; level < levels; ++level) {
+		ranges[level] = levelRange(level, pixelsPerUnit, cellPixels);
+		if (level == levels - 1)
+			morphRanges[level] = glm::vec2{ 1e30f, 2e30f };
+		else
+			morphRanges[level] = glm::vec2{ previous + (ranges[level] - previous) * morphStart, ranges[level] };
+		previous = ranges[level];
+	}
+}
+
+float CdlodTerrain::levelRange(unsigned int level, float pixelsPerUnit, float cellPixels) const
+{
+	//The roots are always drawn, at least at the coarsest lod
+	if (level == levels - 1)
+		return std::numeric_limits<float>::max();
+	float cellWidth = (1u << level) * spacing;
+	return std::max(cellWidth * pixelsPerUnit / cellPixels, 3.0f * patchCells * cellWidth);
+}
+
+void CdlodTerrain::selectNodes(const ChunkNodes& chunk, const glm::vec3& camPos, const ChunkCuller& culler)
+{
+	selectNode(chunk, levels - 1, 0, 0, camPos, culler);
+}
+
+bool CdlodTerrain::selectNode(const ChunkNodes& chunk, unsigned int level, unsigned int x, unsigned int z, const glm::vec3& camPos, const ChunkCuller& culler)
+{
+	AABB bounds = nodeBounds(chunk, level, x, z);
+	float distance = glm::length(glm::clamp(camPos, bounds.min, bounds.max) - camPos);
+	if (distance > ranges[level])
+		return false;
+	if (!culler.inFrustum(bounds))
+		return true;
+
+	unsigned int nodeCells = patchCells << level;
+	Instance instance{ chunk.origin.x, chunk.origin.y, chunk.minHeight, chunk.maxHeight,
+		static_cast<int>(x * nodeCells), static_cast<int>(z * nodeCells), static_cast<int>(level), static_cast<int>(chunk.layer) };
+	if (level == chunk.minLevel || distance > ranges[level - 1]) {
+		fullNodes.push_back(instance);
+		return true;
+	}
+
+	//Children beyond the finer range are drawn at this lod, with a quarter of the patch
+	for (unsigned int child = 0; child < 4; ++child) {
+		unsigned int cx = 2 * x + (child & 1), cz = 2 * z + (child >> 1);
+		if (!selectNode(chunk, level - 1, cx, cz, camPos, culler) && culler.inFrustum(nodeBounds(chunk, level - 1, cx, cz))) {
+			instance.gridX = static_cast<int>(cx * nodeCells / 2);
+			instance.gridZ = static_cast<int>(cz * nodeCells / 2);
+			quarterNodes.push_back(instance);
+		}
+	}
+	return true;
+}
+
+AABB CdlodTerrain::nodeBounds(const ChunkNodes& chunk, unsigned int level, unsigned int x, unsigned int z) const
+{
+	float width = (patchCells << level) * spacing;
+	unsigned int node = nodeIndex(level, x, z);
+	glm::vec3 min{ chunk.origin.x + x * width, chunk.nodeMinHeights[node], chunk.origin.y + z * width };
+	return AABB{ min, min + glm::vec3{ width, chunk.nodeMaxHeights[node] - chunk.nodeMinHeights[node], width } };
+}
+
+unsigned int CdlodTerrain::draw(const Shader& shader, const glm::vec3& camPos)
+{
+	drawCalls = 0;
+	if (fullNodes.empty() && quarterNodes.empty())
+		return 0;
+
+	std::vector<Instance> instances{ fullNodes };
+	instances.insert(instances.end(), quarterNodes.begin(), quarterNodes.end());
+
+	shader.setBool("cdlod", true);
+	shader.setInt("heightMap", 0);
+	shader.setFloat("gridSpacing", spacing);
+	shader.setVec3("camPos", camPos);
+	for (unsigned int level = 0; level < levels; ++level)
+		shader.setVec2("morphRanges[" + std::to_string(level) + "]", morphRanges[level]);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), &instances[0], GL_STREAM_DRAW);
+
+	//Full nodes and quarter nodes are the two halves of the instance buffer
+	auto drawInstances = [&](size_t first, size_t count, const Range& range) {
+		if (count == 0)
+			return;
+		size_t offset = first * sizeof(Instance);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offset);
+		glVertexAttribIPointer(4, 4, GL_INT, sizeof(Instance), (void*)(offset + offsetof(Instance, gridX)));
+		glDrawElementsInstanced(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(size_t)range.offset, static_cast<GLsizei>(count));
+		++drawCalls;
+	};
+	drawInstances(0, fullNodes.size(), full);
+	drawInstances(fullNodes.size(), quarterNodes.size(), quarter);
+
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	shader.setBool("cdlod", false);
+	return static_cast<unsigned int>(fullNodes.size() * full.count + quarterNodes.size() * quarter.count) / 3;
+}
+
+void CdlodTerrain::addCells(unsigned int cells, unsigned int skip)
+{
+	unsigned int size = patchCells + 1;
+	for (unsigned int z = 0; z < cells; ++z) {
+		for (unsigned int x = 0; x < cells; ++x) {
+			if (x >= skip || z >= skip)
+				addCell(x + size * z, x + size * (z + 1), (x + 1) + size * (z + 1), (x + 1) + size * z);
+		}
+	}
+}
+
+void CdlodTerrain::addCell(unsigned int i1, unsigned int i2, unsigned int i3, unsigned int i4)
+{
+	//diagonal from i1 to i3, ie. top left to bottom right as in ChunkIndexBuffer, which morphing relies on
+	indices.push_back(i1);
+	indices.push_back(i2);
+	indices.push_back(i3);
+	indices.push_back(i1);
+	indices.push_back(i3);
+	indices.push_back(i4);
+}
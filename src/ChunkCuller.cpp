@@ -0,0 +1,469 @@
+#include "..\header\ChunkCuller.h"
+#include "..\header\ChunkIndexBuffer.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+ChunkCuller::ChunkCuller(unsigned int _gridSize, int _maxLod, unsigned int _occluderCells, unsigned int _patchesPerSide)
+	: gridSize{ _gridSize }, maxLod{ _maxLod }, occluderCells{ _occluderCells }, patchesPerSide{ _patchesPerSide }
+{
+	depth = 1;
+	while ((1u << depth) < gridSize)
+		++depth;
+
+	// Every level starts out empty
+	const float big = std::numeric_limits<float>::max();
+	levels.resize(depth + 1);
+	for (unsigned int level = 0; level <= depth; ++level) {
+		unsigned int width = 1u << (depth - level);
+		Level& lv = levels[level];
+		for (auto* v : { &lv.minX, &lv.minY, &lv.minZ })
+			v->assign(width * width, big);
+		for (auto* v : { &lv.maxX, &lv.maxY, &lv.maxZ })
+			v->assign(width * width, -big);
+		lv.dirty.assign(width * width, 0);
+		lv.rejectPlane.assign(width * width, noPlane);
+	}
+
+	unsigned int nrChunks = gridSize * gridSize;
+	leafSlot.assign(levels[0].minX.size(), -1);
+	slotLeaf.resize(nrChunks);
+	for (unsigned int slot = 0; slot < nrChunks; ++slot) {
+		slotLeaf[slot] = morton(slot % gridSize, slot / gridSize);
+		leafSlot[slotLeaf[slot]] = slot;
+	}
+
+	for (auto& errors : lodErrors)
+		errors.assign(nrChunks, 0.0f);
+	selectedLods.assign(nrChunks, maxLod);
+	minLods.assign(nrChunks, 1);
+	occluderHeights.assign(nrChunks * occluderCells * occluderCells, 0.0f);
+	patchMinHeights.assign(nrChunks * patchesPerSide * patchesPerSide, 0.0f);
+	patchMaxHeights.assign(nrChunks * patchesPerSide * patchesPerSide, 0.0f);
+	lodFrame.assign(nrChunks, 0);
+	visibleLeaves.reserve(nrChunks);
+	drawList.reserve(nrChunks);
+}
+
+unsigned int ChunkCuller::morton(unsigned int col, unsigned int row)
+{
+	unsigned int code = 0;
+	for (unsigned int bit = 0; bit < 16; ++bit)
+		code |= ((col >> bit) & 1u) << (2 * bit) | ((row >> bit) & 1u) << (2 * bit + 1);
+	return code;
+}
+
+void ChunkCuller::setLeaf(unsigned int leaf, const glm::vec3& min, const glm::vec3& max)
+{
+	Level& lv = levels[0];
+	lv.minX[leaf] = min.x;
+	lv.minY[leaf] = min.y;
+	lv.minZ[leaf] = min.z;
+	lv.maxX[leaf] = max.x;
+	lv.maxY[leaf] = max.y;
+	lv.maxZ[leaf] = max.z;
+	changedLeaves.push_back(leaf);
+}
+
+void ChunkCuller::setChunk(unsigned int slot, const ChunkData& chunk)
+{
+	setLeaf(slotLeaf[slot], chunk.bounds.min, chunk.bounds.max);
+	for (int level = 0; level < 5; ++level)
+		lodErrors[level][slot] = chunk.lodErrors[level];
+	unsigned int cells = occluderCells * occluderCells;
+	std::copy_n(chunk.occluderHeights, cells, occluderHeights.begin() + slot * cells);
+	unsigned int patches = patchesPerSide * patchesPerSide;
+	std::copy_n(chunk.patchMinHeights, patches, patchMinHeights.begin() + slot * patches);
+	std::copy_n(chunk.patchMaxHeights, patches, patchMaxHeights.begin() + slot * patches);
+	selectedLods[slot] = maxLod;
+	minLods[slot] = chunk.minLod;
+	lodFrame[slot] = 0;
+}
+
+void ChunkCuller::setOrigin(unsigned int slot)
+{
+	unsigned int col = slot % gridSize, row = slot / gridSize;
+	if (col == originCol && row == originRow)
+		return;
+
+	unsigned int nrChunks = gridSize * gridSize;
+	movedMin.resize(nrChunks);
+	movedMax.resize(nrChunks);
+	for (unsigned int s = 0; s < nrChunks; ++s) {
+		movedMin[s] = leafMin(slotLeaf[s]);
+		movedMax[s] = leafMax(slotLeaf[s]);
+	}
+
+	originCol = col;
+	originRow = row;
+	std::fill(leafSlot.begin(), leafSlot.end(), -1);
+	for (unsigned int s = 0; s < nrChunks; ++s) {
+		slotLeaf[s] = morton((s % gridSize + gridSize - originCol) % gridSize, (s / gridSize + gridSize - originRow) % gridSize);
+		leafSlot[slotLeaf[s]] = static_cast<int>(s);
+	}
+	for (unsigned int s = 0; s < nrChunks; ++s)
+		setLeaf(slotLeaf[s], movedMin[s], movedMax[s]);
+
+	//The rejecting planes were remembered for nodes that now hold other chunks
+	for (Level& lv : levels)
+		std::fill(lv.rejectPlane.begin(), lv.rejectPlane.end(), noPlane);
+	culledValid = false;
+}
+
+void ChunkCuller::removeChunk(unsigned int slot)
+{
+	const float big = std::numeric_limits<float>::max();
+	setLeaf(slotLeaf[slot], glm::vec3{ big }, glm::vec3{ -big });
+}
+
+void ChunkCuller::setPlanes(const std::vector<CameraPlane>& cameraPlanes)
+{
+	planes.clear();
+	for (const CameraPlane& plane : cameraPlanes)
+		planes.push_back({ plane.normal.x, plane.normal.y, plane.normal.z, -glm::dot(plane.normal, plane.point) });
+}
+
+bool ChunkCuller::inFrustum(const AABB& bounds) const
+{
+	for (const Plane& plane : planes) {
+		//Corner furthest inside the plane
+		float x = plane.nx > 0.0f ? bounds.min.x : bounds.max.x;
+		float y = plane.ny > 0.0f ? bounds.min.y : bounds.max.y;
+		float z = plane.nz > 0.0f ? bounds.min.z : bounds.max.z;
+		if (plane.nx * x + plane.ny * y + plane.nz * z + plane.d > 0.0f)
+			return false;
+	}
+	return true;
+}
+
+void ChunkCuller::setOcclusion(bool use, const glm::mat4& _viewProjection)
+{
+	if (use != occlusionCulling)
+		culledValid = false;
+	occlusionCulling = use;
+	viewProjection = _viewProjection;
+}
+
+glm::vec3 ChunkCuller::leafMin(unsigned int leaf) const
+{
+	const Level& lv = levels[0];
+	return { lv.minX[leaf], lv.minY[leaf], lv.minZ[leaf] };
+}
+
+glm::vec3 ChunkCuller::leafMax(unsigned int leaf) const
+{
+	const Level& lv = levels[0];
+	return { lv.maxX[leaf], lv.maxY[leaf], lv.maxZ[leaf] };
+}
+
+void ChunkCuller::refit()
+{
+	for (unsigned int level = 1; level <= depth && !changedLeaves.empty(); ++level) {
+		Level& lv = levels[level];
+		const Level& children = levels[level - 1];
+
+		changedNodes.clear();
+		for (unsigned int child : changedLeaves) {
+			unsigned int node = child >> 2;
+			if (!lv.dirty[node]) {
+				lv.dirty[node] = 1;
+				changedNodes.push_back(node);
+			}
+		}
+
+		for (unsigned int node : changedNodes) {
+			unsigned int first = node * 4;
+			lv.minX[node] = std::min({ children.minX[first], children.minX[first + 1], children.minX[first + 2], children.minX[first + 3] });
+			lv.minY[node] = std::min({ children.minY[first], children.minY[first + 1], children.minY[first + 2], children.minY[first + 3] });
+			lv.minZ[node] = std::min({ children.minZ[first], children.minZ[first + 1], children.minZ[first + 2], children.minZ[first + 3] });
+			lv.maxX[node] = std::max({ children.maxX[first], children.maxX[first + 1], children.maxX[first + 2], children.maxX[first + 3] });
+			lv.maxY[node] = std::max({ children.maxY[first], children.maxY[first + 1], children.maxY[first + 2], children.maxY[first + 3] });
+			lv.maxZ[node] = std::max({ children.maxZ[first], children.maxZ[first + 1], children.maxZ[first + 2], children.maxZ[first + 3] });
+			lv.dirty[node] = 0;
+		}
+		changedLeaves.swap(changedNodes);
+	}
+	changedLeaves.clear();
+}
+
+void ChunkCuller::update(const glm::vec3& _camPos, const LodParameters& _params)
+{
+	camPos = _camPos;
+	params = _params;
+	++frame;
+	nodesTested = 0;
+	planeTests = 0;
+
+	reused = temporalCoherence && culledValid && changedLeaves.empty() && planesUnchanged();
+	if (!reused) {
+		refit();
+		visibleLeaves.clear();
+		if (planes.empty())
+			addSubtree(depth, 0);
+		else
+			cullChildren(depth - 1, 0, (1u << planes.size()) - 1);
+		occludedChunks = 0;
+		if (occlusionCulling)
+			cullOccluded();
+
+		culledPatches = 0;
+		for (VisibleLeaf& visible : visibleLeaves)
+			visible.patchMask = patchCulling ? cullPatches(visible.leaf, visible.planeMask) : allPatches();
+		culledPlanes = planes;
+		culledValid = true;
+	}
+
+	drawList.clear();
+	for (const VisibleLeaf& visible : visibleLeaves) {
+		unsigned int slot = leafSlot[visible.leaf];
+		drawList.push_back({ slot, getLod(slot), visible.patchMask });
+	}
+}
+
+uint32_t ChunkCuller::cullPatches(unsigned int leaf, uint32_t planeMask)
+{
+	uint32_t visible = allPatches();
+	if (planeMask == 0)
+		return visible;
+
+	glm::vec3 min = leafMin(leaf), max = leafMax(leaf);
+	float patchX = (max.x - min.x) / patchesPerSide;
+	float patchZ = (max.z - min.z) / patchesPerSide;
+	unsigned int nrPatches = patchesPerSide * patchesPerSide;
+	const float* minHeights = &patchMinHeights[leafSlot[leaf] * nrPatches];
+	const float* maxHeights = &patchMaxHeights[leafSlot[leaf] * nrPatches];
+	const __m128 zero = _mm_setzero_ps();
+
+	// Same n-vertex test as the tree nodes, four patches at a time
+	for (unsigned int first = 0; first < nrPatches; first += 4) {
+		alignas(16) float bounds[6][4];
+		for (unsigned int k = 0; k < 4; ++k) {
+			unsigned int p = std::min(first + k, nrPatches - 1);
+			float x0 = min.x + (p % patchesPerSide) * patchX, z0 = min.z + (p / patchesPerSide) * patchZ;
+			bounds[0][k] = x0;
+			bounds[1][k] = minHeights[p];
+			bounds[2][k] = z0;
+			bounds[3][k] = x0 + patchX;
+			bounds[4][k] = maxHeights[p];
+			bounds[5][k] = z0 + patchZ;
+		}
+		__m128 minX = _mm_load_ps(bounds[0]), minY = _mm_load_ps(bounds[1]), minZ = _mm_load_ps(bounds[2]);
+		__m128 maxX = _mm_load_ps(bounds[3]), maxY = _mm_load_ps(bounds[4]), maxZ = _mm_load_ps(bounds[5]);
+
+		// Padding lanes past the last patch count as rejected from the start
+		int outsideMask = 0xF & ~((1 << std::min(4u, nrPatches - first)) - 1);
+		for (unsigned int i = 0; i < planes.size() && outsideMask != 0xF; ++i) {
+			if (!(planeMask & (1u << i)))
+				continue;
+			const Plane& plane = planes[i];
+			for (int k = 0; k < 4; ++k)
+				planeTests += (outsideMask >> k & 1) ^ 1;
+			__m128 nx = _mm_set1_ps(plane.nx), ny = _mm_set1_ps(plane.ny), nz = _mm_set1_ps(plane.nz), d = _mm_set1_ps(plane.d);
+			__m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, plane.nx >= 0 ? minX : maxX), _mm_mul_ps(ny, plane.ny >= 0 ? minY : maxY)),
+				_mm_add_ps(_mm_mul_ps(nz, plane.nz >= 0 ? minZ : maxZ), d));
+			outsideMask |= _mm_movemask_ps(_mm_cmpgt_ps(n, zero));
+		}
+		for (unsigned int k = 0; k < 4 && first + k < nrPatches; ++k) {
+			if (outsideMask & (1 << k)) {
+				visible &= ~(1u << (first + k));
+				++culledPatches;
+			}
+		}
+	}
+	return visible;
+}
+
+bool ChunkCuller::planesUnchanged() const
+{
+	if (planes.size() != culledPlanes.size())
+		return false;
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		const Plane& a = planes[i];
+		const Plane& b = culledPlanes[i];
+		if (std::abs(a.nx - b.nx) > planeEpsilon || std::abs(a.ny - b.ny) > planeEpsilon ||
+			std::abs(a.nz - b.nz) > planeEpsilon || std::abs(a.d - b.d) > planeEpsilon)
+			return false;
+	}
+	return true;
+}
+
+void ChunkCuller::cullOccluded()
+{
+	leavesByDistance.clear();
+	for (unsigned int i = 0; i < visibleLeaves.size(); ++i) {
+		unsigned int leaf = visibleLeaves[i].leaf;
+		glm::vec3 closest = glm::max(leafMin(leaf), glm::min(camPos, leafMax(leaf)));
+		leavesByDistance.push_back({ glm::distance(camPos, closest), i });
+	}
+	std::sort(leavesByDistance.begin(), leavesByDistance.end());
+	frustumLeaves.swap(visibleLeaves);
+
+	occlusion.clear(viewProjection);
+	visibleLeaves.clear();
+	unsigned int occluders = 0;
+	for (const auto& [distance, i] : leavesByDistance) {
+		unsigned int leaf = frustumLeaves[i].leaf;
+		if (occlusion.isOccluded(leafMin(leaf), leafMax(leaf))) {
+			++occludedChunks;
+			continue;
+		}
+		visibleLeaves.push_back(frustumLeaves[i]);
+		if (occluders < maxOccluders) {
+			addOccluder(leaf);
+			++occluders;
+		}
+	}
+}
+
+void ChunkCuller::addOccluder(unsigned int leaf)
+{
+	glm::vec3 min = leafMin(leaf), max = leafMax(leaf);
+	float cellX = (max.x - min.x) / occluderCells;
+	float cellZ = (max.z - min.z) / occluderCells;
+	const float* heights = &occluderHeights[leafSlot[leaf] * occluderCells * occluderCells];
+
+	// Each cell is a solid column from the bottom of the chunk up to its lowest height, draw the top and the sides facing the camera
+	auto addQuad = [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d) {
+		occlusion.addTriangle(a, b, c);
+		occlusion.addTriangle(a, c, d);
+	};
+	for (unsigned int z = 0; z < occluderCells; ++z) {
+		for (unsigned int x = 0; x < occluderCells; ++x) {
+			float h = heights[x + occluderCells * z];
+			float x0 = min.x + x * cellX, x1 = x0 + cellX;
+			float z0 = min.z + z * cellZ, z1 = z0 + cellZ;
+			if (camPos.y > h)
+				addQuad({ x0, h, z0 }, { x1, h, z0 }, { x1, h, z1 }, { x0, h, z1 });
+			if (camPos.x < x0)
+				addQuad({ x0, min.y, z0 }, { x0, h, z0 }, { x0, h, z1 }, { x0, min.y, z1 });
+			if (camPos.x > x1)
+				addQuad({ x1, min.y, z0 }, { x1, h, z0 }, { x1, h, z1 }, { x1, min.y, z1 });
+			if (camPos.z < z0)
+				addQuad({ x0, min.y, z0 }, { x0, h, z0 }, { x1, h, z0 }, { x1, min.y, z0 });
+			if (camPos.z > z1)
+				addQuad({ x0, min.y, z1 }, { x0, h, z1 }, { x1, h, z1 }, { x1, min.y, z1 });
+		}
+	}
+}
+
+void ChunkCuller::cullChildren(unsigned int level, unsigned int first, uint32_t planeMask)
+{
+	Level& lv = levels[level];
+
+	__m128 minX = _mm_loadu_ps(&lv.minX[first]), minY = _mm_loadu_ps(&lv.minY[first]), minZ = _mm_loadu_ps(&lv.minZ[first]);
+	__m128 maxX = _mm_loadu_ps(&lv.maxX[first]), maxY = _mm_loadu_ps(&lv.maxY[first]), maxZ = _mm_loadu_ps(&lv.maxZ[first]);
+	const __m128 zero = _mm_setzero_ps();
+
+	// Planes that rejected one of the children last time go first, the rest in the usual order
+	uint8_t order[32];
+	unsigned int nrPlanes = 0;
+	uint32_t queued = 0;
+	if (temporalCoherence) {
+		for (unsigned int k = 0; k < 4; ++k) {
+			uint8_t cached = lv.rejectPlane[first + k];
+			if (cached != noPlane && (planeMask & ~queued & (1u << cached))) {
+				order[nrPlanes++] = cached;
+				queued |= 1u << cached;
+			}
+		}
+	}
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		if (planeMask & ~queued & (1u << i))
+			order[nrPlanes++] = static_cast<uint8_t>(i);
+	}
+
+	// Empty nodes outside the grid count as rejected from the start
+	int outsideMask = _mm_movemask_ps(_mm_cmpgt_ps(minX, maxX));
+	for (int k = 0; k < 4; ++k)
+		nodesTested += (outsideMask >> k & 1) ^ 1;
+	uint32_t childMasks[4] = { planeMask, planeMask, planeMask, planeMask };
+	for (unsigned int j = 0; j < nrPlanes && outsideMask != 0xF; ++j) {
+		unsigned int i = order[j];
+		const Plane& plane = planes[i];
+		for (int k = 0; k < 4; ++k)
+			planeTests += (outsideMask >> k & 1) ^ 1;
+		__m128 nx = _mm_set1_ps(plane.nx), ny = _mm_set1_ps(plane.ny), nz = _mm_set1_ps(plane.nz), d = _mm_set1_ps(plane.d);
+
+		// n-vertex is the corner furthest against the normal, p-vertex the corner furthest along it
+		__m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, plane.nx >= 0 ? minX : maxX), _mm_mul_ps(ny, plane.ny >= 0 ? minY : maxY)),
+			_mm_add_ps(_mm_mul_ps(nz, plane.nz >= 0 ? minZ : maxZ), d));
+		__m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, plane.nx >= 0 ? maxX : minX), _mm_mul_ps(ny, plane.ny >= 0 ? maxY : minY)),
+			_mm_add_ps(_mm_mul_ps(nz, plane.nz >= 0 ? maxZ : minZ), d));
+		int rejected = _mm_movemask_ps(_mm_cmpgt_ps(n, zero)) & ~outsideMask;
+		for (int k = 0; k < 4; ++k) {
+			if (rejected & (1 << k))
+				lv.rejectPlane[first + k] = static_cast<uint8_t>(i);
+		}
+		outsideMask |= rejected;
+
+		// Children completely inside this plane don't need to test it again
+		int inside = _mm_movemask_ps(_mm_cmple_ps(p, zero));
+		for (int k = 0; k < 4; ++k) {
+			if (inside & (1 << k))
+				childMasks[k] &= ~(1u << i);
+		}
+	}
+
+	for (unsigned int k = 0; k < 4; ++k) {
+		if (outsideMask & (1 << k))
+			continue;
+		unsigned int node = first + k;
+		if (level == 0)
+			addLeaf(node, childMasks[k]);
+		else if (childMasks[k] == 0)
+			addSubtree(level, node);
+		else
+			cullChildren(level - 1, node * 4, childMasks[k]);
+	}
+}
+
+void ChunkCuller::addSubtree(unsigned int level, unsigned int node)
+{
+	if (levels[level].minX[node] > levels[level].maxX[node])
+		return;
+	if (level == 0) {
+		addLeaf(node, 0);
+		return;
+	}
+	for (unsigned int k = 0; k < 4; ++k)
+		addSubtree(level - 1, node * 4 + k);
+}
+
+void ChunkCuller::addLeaf(unsigned int leaf, uint32_t planeMask)
+{
+	if (leafSlot[leaf] >= 0)
+		visibleLeaves.push_back({ leaf, planeMask, allPatches() });
+}
+
+int ChunkCuller::getLod(unsigned int slot)
+{
+	if (lodFrame[slot] != frame) {
+		// Distance from the camera to the closest point of the chunk bounds
+		const Level& lv = levels[0];
+		unsigned int leaf = slotLeaf[slot];
+		glm::vec3 closest = glm::max(glm::vec3{ lv.minX[leaf], lv.minY[leaf], lv.minZ[leaf] }, glm::min(camPos, glm::vec3{ lv.maxX[leaf], lv.maxY[leaf], lv.maxZ[leaf] }));
+
+		selectedLods[slot] = selectLod(slot, glm::distance(camPos, closest));
+		lodFrame[slot] = frame;
+	}
+	// A fixed lod is only drawn, the selection above keeps following the camera
+	if (params.fixedLod > 0)
+		return std::max(params.fixedLod, minLods[slot]);
+	return selectedLods[slot];
+}
+
+int ChunkCuller::selectLod(unsigned int slot, float distance) const
+{
+	float scale = params.pixelsPerUnit / std::max(distance, params.minDistance);
+	auto pixelError = [&](int lod) { return lodErrors[ChunkIndexBuffer::lodLevel(lod)][slot] * scale; };
+
+	int lod = std::max(selectedLods[slot], minLods[slot]);
+	// Refine as long as the current lod is visibly wrong
+	while (lod > minLods[slot] && pixelError(lod) > params.tolerance)
+		lod /= 2;
+	// Coarsen only with a margin below the tolerance
+	while (lod < maxLod && pixelError(lod * 2) <= params.tolerance * (1.0f - params.hysteresis))
+		lod *= 2;
+	return lod;
+}
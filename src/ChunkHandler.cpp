@@ -1,47 +1,35 @@
 #include "..\header\ChunkHandler.h"
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <cassert>
 
 ChunkHandler::ChunkHandler(unsigned int _gridSize, unsigned int _nrVertices, float _spacing, float _yscale)
-	: gridSize{ (_gridSize % 2 == 0 ? (_gridSize + 1) : _gridSize) }, nrVertices{ _nrVertices }, spacing{ _spacing }, yscale{ _yscale }, currentChunk{ nullptr }
+	: gridSize{ (_gridSize % 2 == 0 ? (_gridSize + 1) : _gridSize) }, nrVertices{ _nrVertices }, spacing{ _spacing }, yscale{ _yscale }, 
+	lodIndices{ _nrVertices, 16, patchesPerSide }, culler{ gridSize, 16, (_nrVertices - 1) / 16, patchesPerSide }
 {
+	lodIndices.bake();
+	flatMesh = TerrainMesh{ Chunk::flatVertices(nrVertices), lodIndices.getEBO() };
+	const float flatLodErrors[5] = {};
+	flatAdaptiveIndices = AdaptiveIndexBuffer{ std::vector<float>(nrVertices * nrVertices, TerrainNoise::groundLevel).data(), nrVertices, 16, patchesPerSide, flatLodErrors };
+	flatAdaptiveIndices.bake();
 	//unsigned int size = nrVertices; //two extra rows / columns for the skirts
-	unsigned int lod = 1;
 	float width = (nrVertices - 1) * spacing; //width of 1 chunk, -3 due to extra skirts
-
-	for (int row = 0; row < gridSize; ++row) {
-		float zpos = -width * (static_cast<float>(gridSize) / 2.0f) + row * width;
-		for (int col = 0; col < gridSize; ++col) {
-			float xpos = -width * (static_cast<float>(gridSize) / 2.0f) + col * width;
-
-			chunks.push_back(new Chunk{ nrVertices, lod, xpos, zpos, spacing, index(col, row, gridSize) });
-			chunks.back()->bakeMeshes();
-
-		}
-	}
-	currentChunk = chunks[gridSize * gridSize / 2];
+	origin = glm::vec2{ -width / 2.0f };
+	slotChunks.assign(gridSize * gridSize, nullptr);
+	int half = static_cast<int>(gridSize / 2);
+	culler.setOrigin(slot({ center.x - half, center.z - half }));
+
+	//Nothing is generated here, the first frames show the chunks as they finish
+	fillStart = std::chrono::steady_clock::now();
+	filling = true;
+	computeStepRanges(jobStepRanges);
+	requestChunks(glm::vec3{ 0.0f }, true);
 }
  
 glm::vec3 ChunkHandler::Chunk::createPointWithNoise(float x, float z, float* minY, float* maxY ) const {
-	/*** Apply noise to the height ie. y component using fbm ***/
-	int octaves = 6;
-	float noiseSum = 0.0f;
-	float seed = 0.1f;
-	float amplitude = 6.0f;
-	float gain = 0.5; //How much to increase / decrease each octave
-	float lacunarity = 2.0; //How much to increase / decrease frequency each octave ie. how big steps to take in the noise space
-	float freq = 0.09f;
-
-	//Add noise from all octaves
-	for (int i = 0; i < octaves; ++i) {
-		noiseSum += amplitude * glm::perlin(glm::vec3((x + 1) * freq, (z + 1) * freq, seed));
-		freq *= lacunarity;
-		amplitude *= gain;
-	}
-
-	float noiseY = noiseSum;
-	float groundlevel = -1.51f;
-	if (noiseY < groundlevel)
-		noiseY = groundlevel;
+	float noiseY = TerrainNoise::height(x, z);
 
 	glm::vec3 pos{ x, noiseY, z };
 
@@ -63,7 +51,7 @@ glm::vec3 ChunkHandler::Chunk::createFakeVertex(int width, int depth) const {
 	return createPointWithNoise(x, z);
 }
 
-glm::vec3 ChunkHandler::Chunk::computeNormal(const std::vector<glm::vec3>& p,const glm::vec3& v0) const {
+glm::vec3 ChunkHandler::Chunk::computeNormal(const std::array<glm::vec3, 8>& p,const glm::vec3& v0) const {
 	glm::vec3 ne = p[0], n = p[1], nw = p[2], w = p[3], sw = p[4], s = p[5], se = p[6], e = p[7];
 	glm::vec3 normal = { 0.0f, 0.0f, 0.0f };
 	glm::vec3 e1, e2, e3;
@@ -94,15 +82,301 @@ glm::vec3 ChunkHandler::Chunk::computeNormal(const std::vector<glm::vec3>& p,con
 	return normal;
 }
 
-void ChunkHandler::Chunk::bakeMeshes() {
-	mesh = Mesh{ vertices, indices };
-	boundingBox = BoundingBox{ points };
+void ChunkHandler::Chunk::bakeMeshes(const ChunkIndexBuffer& lodIndices, TerrainMesh& flatMesh, const AdaptiveIndexBuffer& flatAdaptiveIndices, bool adaptive) {
+	if (flat) {
+		drawMesh = &flatMesh;
+		drawAdaptiveIndices = &flatAdaptiveIndices;
+	}
+	else if (!meshBaked) {
+		//The chunk keeps the only copy in RAM
+		restoreGeometry();
+		mesh = TerrainMesh{ std::move(vertices), lodIndices.getEBO() };
+		vertices = mesh.releaseGeometry();
+		meshBaked = true;
+		useAdaptiveIndices(adaptive, lodIndices);
+	}
+}
+
+void ChunkHandler::Chunk::releaseMesh() {
+	if (cdlod == nullptr)
+		restoreGeometry();
+	mesh.deleteMesh();
+	meshBaked = false;
+}
+
+std::vector<TerrainVertex> ChunkHandler::Chunk::releaseGeometry() {
+	std::vector<TerrainVertex> storage;
+	if (flat || (!released && (meshBaked || cdlod != nullptr))) {
+		storage.swap(vertices);
+		released = !flat;
+	}
+	return storage;
+}
+
+void ChunkHandler::Chunk::restoreGeometry() {
+	if (!released)
+		return;
+	vertices.resize(nrVertices * nrVertices);
+	readVertices(vertices.data());
+	released = false;
+}
+
+void ChunkHandler::Chunk::readVertices(TerrainVertex* packed) const {
+	if (meshBaked)
+		mesh.readVertices(packed);
+	else
+		cdlod->readChunk(heightLayer, packed);
+}
+
+const TerrainVertex* ChunkHandler::Chunk::packedVertices(ScratchVector<TerrainVertex>& readBack) const {
+	if (!released)
+		return vertices.data();
+	readBack.resize(nrVertices * nrVertices);
+	readVertices(readBack.data());
+	return readBack.data();
+}
+
+void ChunkHandler::Chunk::uploadHeights(CdlodTerrain& _cdlod) {
+	if (flat)
+		return;
+	assert(!released);
+	heightLayer = _cdlod.uploadChunk(vertices.data());
+	if (heightLayer != CdlodTerrain::flatLayer)
+		cdlod = &_cdlod;
+}
+
+void ChunkHandler::Chunk::buildAdaptiveIndices(WorkerPool* pool) {
+	if (flat || step > 1 || adaptiveIndices.isBuilt())
+		return;
+
+	ScratchArena::Scope scratch;
+	unsigned int size = nrVertices - 2;
+	ScratchVector<float> heights(size * size);
+	decodeHeights(heights.data());
+	adaptiveIndices = AdaptiveIndexBuffer{ heights.data(), size, 16, patchesPerSide, lodErrors, pool };
+}
 
-	if (higherLod)
-		higherLod->bakeMeshes();
+void ChunkHandler::Chunk::decodeHeights(float* heights) const {
+	//The quantization step is far below any lod error
+	ScratchArena::Scope scratch;
+	ScratchVector<TerrainVertex> readBack;
+	const TerrainVertex* packed = packedVertices(readBack);
+	unsigned int size = nrVertices - 2;
+	for (unsigned int depth = 1; depth <= size; ++depth) {
+		for (unsigned int width = 1; width <= size; ++width) {
+			*heights++ = minHeight + (maxHeight - minHeight) * packed[index(width, depth)].height / 65535.0f;
+		}
+	}
+}
+
+void ChunkHandler::Chunk::useAdaptiveIndices(bool use, const ChunkIndexBuffer& lodIndices) {
+	if (flat || step > 1 || !meshBaked)
+		return;
+
+	if (use) {
+		if (!adaptiveIndices.isBuilt())
+			return;
+		if (!adaptiveIndices.isBaked())
+			adaptiveIndices.bake();
+		mesh.setElementBuffer(adaptiveIndices.getEBO());
+	}
+	else {
+		mesh.setElementBuffer(lodIndices.getEBO());
+	}
 }
 
-glm::vec3 ChunkHandler::Chunk::setColorFromLOD() {
+std::vector<TerrainVertex> ChunkHandler::Chunk::flatVertices(unsigned int _nrVertices) {
+	//Same as packVertex gives for a chunk at ground level, every height is 0 and every normal points straight up
+	unsigned int size = _nrVertices + 2;
+	std::vector<TerrainVertex> flatGrid;
+	flatGrid.reserve(size * size);
+	for (unsigned int depth = 0; depth < size; ++depth) {
+		for (unsigned int width = 0; width < size; ++width) {
+			TerrainVertex v;
+			v.gridX = static_cast<uint8_t>(width == 0 ? 0 : (width == size - 1 ? size - 3 : width - 1));
+			v.gridZ = static_cast<uint8_t>(depth == 0 ? 0 : (depth == size - 1 ? size - 3 : depth - 1));
+			if (depth == 0 || depth == size - 1 || width == 0 || width == size - 1)
+				v.flags = TerrainVertex::skirtFlag;
+			flatGrid.push_back(v);
+		}
+	}
+	return flatGrid;
+}
+
+void ChunkHandler::Chunk::makeFlat() {
+	float ground = TerrainNoise::groundLevel;
+	float span = (nrVertices - 3) * SPACING;
+	flat = true;
+	step = 1;
+	minHeight = maxHeight = ground;
+	bounds = AABB{ { XPOS, ground, ZPOS }, { XPOS + span, ground, ZPOS + span } };
+	std::fill(lodErrors, lodErrors + 5, 0.0f);
+	unsigned int cells = (nrVertices - 3) / 16;
+	occluderHeights.assign(cells * cells, ground);
+	patchMinHeights.assign(patchesPerSide * patchesPerSide, ground);
+	patchMaxHeights.assign(patchesPerSide * patchesPerSide, ground);
+	nodeMinHeights.assign(CdlodTerrain::nodeCount(), ground);
+	nodeMaxHeights.assign(CdlodTerrain::nodeCount(), ground);
+	vertices.clear();
+}
+
+unsigned int ChunkHandler::Chunk::gridCoordinate(int i) const {
+	if (i == 0) //first skirt shares position with the first vertex
+		return 0;
+	if (i == nrVertices - 1) //last skirt shares position with the last vertex
+		return nrVertices - 3;
+	return i - 1;
+}
+
+TerrainVertex ChunkHandler::Chunk::packVertex(const Vertex& v, int width, int depth) const {
+	TerrainVertex packed;
+	packed.gridX = static_cast<uint8_t>(gridCoordinate(width));
+	packed.gridZ = static_cast<uint8_t>(gridCoordinate(depth));
+
+	if (depth == 0 || depth == nrVertices - 1 || width == 0 || width == nrVertices - 1) //skirts are placed at skirtDepth by the shader
+		packed.flags = TerrainVertex::skirtFlag;
+	else if (maxHeight > minHeight) {
+		float h = (v.position.y - minHeight) / (maxHeight - minHeight);
+		packed.height = static_cast<uint16_t>(std::round(glm::clamp(h, 0.0f, 1.0f) * 65535.0f));
+	}
+
+	//Octahedral encoding with y as the main axis, project onto the octahedron and fold the lower hemisphere
+	glm::vec3 n = v.normal / (std::abs(v.normal.x) + std::abs(v.normal.y) + std::abs(v.normal.z));
+	float ox = n.x, oz = n.z;
+	if (n.y < 0.0f) {
+		ox = (1.0f - std::abs(n.z)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		oz = (1.0f - std::abs(n.x)) * (n.z >= 0.0f ? 1.0f : -1.0f);
+	}
+	packed.normal[0] = static_cast<int8_t>(std::round(glm::clamp(ox, -1.0f, 1.0f) * 127.0f));
+	packed.normal[1] = static_cast<int8_t>(std::round(glm::clamp(oz, -1.0f, 1.0f) * 127.0f));
+
+	return packed;
+}
+
+void ChunkHandler::Chunk::setUniforms(const Shader& shader, int lod) const {
+	shader.setVec2("chunkOrigin", glm::vec2{ XPOS, ZPOS });
+	shader.setFloat("gridSpacing", SPACING);
+	shader.setVec2("heightRange", glm::vec2{ minHeight, maxHeight });
+	shader.setFloat("skirtDepth", skirtDepth);
+	shader.setVec3("lodColor", setColorFromLOD(lod));
+}
+
+void ChunkHandler::Chunk::computeLodErrors(const Grid& grid) {
+	int span = nrVertices - 3; //chunk width in full resolution steps
+	auto height = [&](int x, int z) { return grid[index(x + 1, z + 1)].position.y; };
+
+	//Errors against the step lattice, of a coarse chunk also at the lod above the step
+	float latticeErrors[6] = {};
+	int lastLod = std::max(16, 2 * step);
+	int level = 1;
+	for (int lod = 2; lod <= lastLod; lod *= 2, ++level) {
+		if (lod < step) //never drawn
+			continue;
+		float maxError = 0.0f;
+		for (int z0 = 0; z0 < span; z0 += lod) {
+			for (int x0 = 0; x0 < span; x0 += lod) {
+				float h00 = height(x0, z0), h10 = height(x0 + lod, z0), h01 = height(x0, z0 + lod), h11 = height(x0 + lod, z0 + lod);
+				//Compare every sampled vertex of the step lattice in the cell with the two triangles split from top left to bottom right
+				for (int z = 0; z <= lod; z += step) {
+					for (int x = 0; x <= lod; x += step) {
+						float u = static_cast<float>(x) / lod, v = static_cast<float>(z) / lod;
+						float coarse = u >= v ? h00 + u * (h10 - h00) + v * (h11 - h10) : h00 + v * (h01 - h00) + u * (h11 - h01);
+						maxError = std::max(maxError, std::abs(height(x0 + x, z0 + z) - coarse));
+					}
+				}
+			}
+		}
+		latticeErrors[level] = maxError;
+	}
+
+	//A coarse chunk does not know how far its lattice is from the terrain. Coarser lods miss far more than the lattice does, so their errors
+	//against it are kept, and each octave has half the amplitude at twice the frequency so the error of the lattice is about half the next coarser one
+	float stepError = step > 1 ? latticeErrors[ChunkIndexBuffer::lodLevel(2 * step)] / 2.0f : 0.0f;
+	lodErrors[0] = stepError / step;
+	for (level = 1; level < 5; ++level) {
+		int lod = 1 << level;
+		float error = lod <= step ? stepError * lod / step : latticeErrors[level];
+		//a lod can not be more accurate than the finer lods
+		lodErrors[level] = std::max(error, lodErrors[level - 1]);
+	}
+}
+
+void ChunkHandler::Chunk::computePatchHeights(const Grid& grid) {
+	int patches = patchesPerSide;
+	int patchSpan = (nrVertices - 3) / patches;
+	patchMinHeights.assign(patches * patches, std::numeric_limits<float>::max());
+	patchMaxHeights.assign(patches * patches, std::numeric_limits<float>::lowest());
+	for (int pz = 0; pz < patches; ++pz) {
+		for (int px = 0; px < patches; ++px) {
+			float& minHeight = patchMinHeights[px + patches * pz];
+			float& maxHeight = patchMaxHeights[px + patches * pz];
+			for (int z = pz * patchSpan; z <= (pz + 1) * patchSpan; ++z) {
+				for (int x = px * patchSpan; x <= (px + 1) * patchSpan; ++x) {
+					if (!isSampled(x, z))
+						continue;
+					float y = grid[index(x + 1, z + 1)].position.y;
+					minHeight = std::min(minHeight, y);
+					maxHeight = std::max(maxHeight, y);
+				}
+			}
+		}
+	}
+}
+
+void ChunkHandler::Chunk::computeNodeHeights(const Grid& grid) {
+	int leaves = 1 << (CdlodTerrain::levels - 1); //finest nodes per side
+	int leafSpan = (nrVertices - 3) / leaves;
+	nodeMinHeights.assign(CdlodTerrain::nodeCount(), std::numeric_limits<float>::max());
+	nodeMaxHeights.assign(CdlodTerrain::nodeCount(), std::numeric_limits<float>::lowest());
+	for (int nz = 0; nz < leaves; ++nz) {
+		for (int nx = 0; nx < leaves; ++nx) {
+			unsigned int node = CdlodTerrain::nodeIndex(0, nx, nz);
+			for (int z = nz * leafSpan; z <= (nz + 1) * leafSpan; ++z) {
+				for (int x = nx * leafSpan; x <= (nx + 1) * leafSpan; ++x) {
+					//leaves finer than the step may hold no sample, they are never selected
+					if (!isSampled(x, z))
+						continue;
+					float y = grid[index(x + 1, z + 1)].position.y;
+					nodeMinHeights[node] = std::min(nodeMinHeights[node], y);
+					nodeMaxHeights[node] = std::max(nodeMaxHeights[node], y);
+				}
+			}
+		}
+	}
+	//A node covers its four children
+	for (unsigned int level = 1; level < CdlodTerrain::levels; ++level) {
+		unsigned int side = leaves >> level;
+		for (unsigned int nz = 0; nz < side; ++nz) {
+			for (unsigned int nx = 0; nx < side; ++nx) {
+				unsigned int node = CdlodTerrain::nodeIndex(level, nx, nz);
+				for (unsigned int child = 0; child < 4; ++child) {
+					unsigned int childNode = CdlodTerrain::nodeIndex(level - 1, 2 * nx + (child & 1), 2 * nz + (child >> 1));
+					nodeMinHeights[node] = std::min(nodeMinHeights[node], nodeMinHeights[childNode]);
+					nodeMaxHeights[node] = std::max(nodeMaxHeights[node], nodeMaxHeights[childNode]);
+				}
+			}
+		}
+	}
+}
+
+void ChunkHandler::Chunk::computeOccluderHeights(const Grid& grid) {
+	int cells = (nrVertices - 3) / 16;
+	occluderHeights.assign(cells * cells, std::numeric_limits<float>::max());
+	for (int cz = 0; cz < cells; ++cz) {
+		for (int cx = 0; cx < cells; ++cx) {
+			float& minHeight = occluderHeights[cx + cells * cz];
+			//cells share their border vertices, the triangles drawn between them never go below the lowest one
+			for (int z = cz * 16; z <= (cz + 1) * 16; ++z) {
+				for (int x = cx * 16; x <= (cx + 1) * 16; ++x) {
+					if (isSampled(x, z))
+						minHeight = std::min(minHeight, grid[index(x + 1, z + 1)].position.y);
+				}
+			}
+		}
+	}
+}
+
+glm::vec3 ChunkHandler::Chunk::setColorFromLOD(int lod) {
 	switch (lod)
 	{
 	case 1:
@@ -121,101 +395,165 @@ glm::vec3 ChunkHandler::Chunk::setColorFromLOD() {
 	}
 }
 
-ChunkHandler::Chunk::Chunk(unsigned int _nrVertices, unsigned int _lod, float xpos, float zpos, float _spacing, unsigned int _id) :
-	lod{ _lod }, nrVertices { (_nrVertices - 1) / _lod + 3 }, XPOS{ xpos }, ZPOS{ zpos }, SPACING{ _spacing * _lod }, id{ _id } {
-	int MAXLOD = 16;
-	unsigned int newLod = _lod * 2;
-	if (newLod <= MAXLOD)
-		higherLod = new Chunk{ _nrVertices, newLod, xpos, zpos, _spacing, 0 };
-		//auto future = std::async(generateLOD, this, _nrVertices, newLod, xpos, zpos, _spacing, _id);
-		//Chunk* temp = future.get();
-	else
-		higherLod = nullptr;
+template<typename Band>
+void ChunkHandler::Chunk::forRowBands(WorkerPool* pool, int rows, const Band& band) {
+	int bands = rowBandCount(rows);
+	auto runBand = [&](unsigned int b) {
+		int first = static_cast<int>(b) * bandRows;
+		band(b, first, std::min(rows, first + bandRows));
+	};
+	if (pool != nullptr) {
+		pool->parallelFor(bands, runBand);
+		return;
+	}
+	for (int b = 0; b < bands; ++b)
+		runBand(b);
+}
+
+std::pair<float, float> ChunkHandler::Chunk::estimateHeights(float xpos, float zpos, unsigned int _size, float _spacing) {
+	//The fake vertices used for the edge normals are one step outside the chunk
+	float span = (_size - 1) * _spacing;
+	return TerrainNoise::estimateHeightRange(xpos - _spacing, zpos - _spacing, xpos + span + _spacing, zpos + span + _spacing);
+}
+
+bool ChunkHandler::Chunk::belowGround(float xpos, float zpos, unsigned int _size, float _spacing, const std::pair<float, float>& heights) {
+	if (heights.second > TerrainNoise::groundLevel)
+		return false;
+	//Corners, centre and the points between them, over the same region as estimateHeights
+	float start = -_spacing, span = (_size + 1) * _spacing;
+	for (int z = 0; z < belowGroundSamples; ++z) {
+		for (int x = 0; x < belowGroundSamples; ++x) {
+			float sampleX = xpos + start + span * x / (belowGroundSamples - 1);
+			float sampleZ = zpos + start + span * z / (belowGroundSamples - 1);
+			if (TerrainNoise::height(sampleX, sampleZ) > TerrainNoise::groundLevel)
+				return false;
+		}
+	}
+	return true;
+}
+
+float ChunkHandler::Chunk::sideHeight(const ChunkSides* sides, int x, int z) const {
+	int span = nrVertices - 3;
+	if (sides != nullptr) {
+		if (z == 0)
+			return (*(*sides)[ChunkIndexBuffer::north])[x];
+		if (z == span)
+			return (*(*sides)[ChunkIndexBuffer::south])[x];
+		if (x == 0)
+			return (*(*sides)[ChunkIndexBuffer::west])[z];
+		if (x == span)
+			return (*(*sides)[ChunkIndexBuffer::east])[z];
+	}
+	return TerrainNoise::height(XPOS + x * SPACING, ZPOS + z * SPACING);
+}
+
+ChunkHandler::Chunk::Chunk(unsigned int _nrVertices, float _spacing) :
+	id{ 0 }, nrVertices{ _nrVertices + 2 }, XPOS{ 0.0f }, ZPOS{ 0.0f }, SPACING{ _spacing } {
+}
+
+ChunkHandler::Chunk::Chunk(unsigned int _nrVertices, float xpos, float zpos, float _spacing, unsigned int _id, unsigned int _step, WorkerPool* pool,
+	const ChunkSides* sides) : Chunk(_nrVertices, _spacing) {
+	std::pair<float, float> heights = estimateHeights(xpos, zpos, _nrVertices, _spacing);
+	generate(xpos, zpos, _id, _step, pool, sides, heights, belowGround(xpos, zpos, _nrVertices, _spacing, heights));
+}
+
+void ChunkHandler::Chunk::recycle() {
+	released = false; //the vertices are generated again
+	releaseMesh();
+	adaptiveIndices.deleteBuffer();
+	adaptiveIndices = AdaptiveIndexBuffer{};
+}
+
+void ChunkHandler::Chunk::generate(float xpos, float zpos, unsigned int _id, unsigned int _step, WorkerPool* pool, const ChunkSides* sides,
+	const std::pair<float, float>& heights, bool belowGround) {
+	XPOS = xpos;
+	ZPOS = zpos;
+	id = _id;
+	step = static_cast<int>(_step);
+	flat = false;
+	drawMesh = &mesh;
+	drawAdaptiveIndices = &adaptiveIndices;
+	heightLayer = CdlodTerrain::flatLayer;
+	cdlod = nullptr;
+	ScratchArena::Scope scratch; //the grids are given back when the chunk is packed
+
+	//Chunks whose noise stays below ground level come out flat, skip generating them. 
+	if (belowGround) {
+		makeFlat();
+		return;
+	}
 
-	vertices.reserve(nrVertices * nrVertices);
-	indices.reserve(6 * (nrVertices - 2) * (nrVertices - 2) + 3 * nrVertices * 4 - 18); // se notes in lecture 6 
-	
-	color = setColorFromLOD();
 	//Need min and max height of this chunk to compute the bounding box
 	float minY = std::numeric_limits<float>::max();
-	float maxY = std::numeric_limits<float>::min();
+	float maxY = std::numeric_limits<float>::lowest();
 
-	/*** Compute vertex positions and indices ***/
-	for (int depth = 0; depth < nrVertices; ++depth)
-	{
-		for (int width = 0; width < nrVertices; ++width) {
-			float x = xpos + (width - 1) * SPACING;
-			float z = zpos + (depth - 1) * SPACING;
-
-			/*** Skirts should be at the same x and z position as the next / previous vertex ***/
-			if (depth == 0) {
-				z = zpos + (depth + 0) * SPACING;
-			}
-			if (depth == nrVertices - 1) {
-				z = zpos + (depth - 2) * SPACING;
-			}
-			if (width == 0) {
-				x = xpos + (width + 0) * SPACING;
-			}
-			if (width == nrVertices - 1) {
-				x = xpos + (width - 2) * SPACING;
-			}
+	if (step > 1) {
+		Grid grid = sampleGrid(minY, maxY, pool, sides);
+		assert(minY >= heights.first && maxY <= heights.second && "height estimate is not conservative");
+		packGrid(grid, minY, maxY, pool);
+		return;
+	}
 
-			if (depth == 0 || depth == nrVertices - 1 || width == 0 || width == nrVertices - 1) //edges of grid ie. skirts
-			{
-				float skirtDepth = -3.0f;
-				glm::vec3 pos{ x, skirtDepth, z };
-				vertices.push_back({ pos });
-			}
-			else //Non edges compute noise value for the y-component
-			{
-				auto pos = createPointWithNoise(x, z, &minY, &maxY);
-				vertices.push_back({ pos });
-			}
-			vertices.back().color = color;
-			if (depth == 0 || depth == nrVertices - 1 || width == 0 || width == nrVertices - 1) //edges of grid ie. skirts
-			{
-				vertices.back().color = glm::vec3{ 1.0f, 0.0f, 1.0f };
-			}
+	Grid grid(nrVertices * nrVertices); //full precision vertices, packed once the height range of the chunk is known
 
-			//add indices to create triangle list
-			if (width < nrVertices - 1 && depth < nrVertices - 1) {
-				unsigned int i1, i2, i3, i4;
-				i1 = index(width, depth); //current
-				i2 = index(width, depth + 1); //bottom
-				i3 = index(width + 1, depth + 1); //bottom right
-				i4 = index(width + 1, depth); // right 
-
-				/*
-					i1--<--i4
-					 |\    |
-					 v \   ^
-					 |  \  |
-					 |   \ |
-					i2-->--i3
-				*/
-
-				//left triangle diagonal from top left to bottom right 
-				indices.push_back(i1);
-				indices.push_back(i2);
-				indices.push_back(i3);
-				//right triangle
-				indices.push_back(i1);
-				indices.push_back(i3);
-				indices.push_back(i4);
+	/*** Compute vertex positions ***/
+	//Rows are computed in bands on the pool, each band keeps its own height range
+	ScratchVector<float> bandMinY(rowBandCount(nrVertices), minY), bandMaxY(rowBandCount(nrVertices), maxY);
+	forRowBands(pool, nrVertices, [&](int band, int firstRow, int endRow) {
+		for (int depth = firstRow; depth < endRow; ++depth)
+		{
+			for (int width = 0; width < nrVertices; ++width) {
+				float x = xpos + (width - 1) * SPACING;
+				float z = zpos + (depth - 1) * SPACING;
+
+				/*** Skirts should be at the same x and z position as the next / previous vertex ***/
+				if (depth == 0) {
+					z = zpos + (depth + 0) * SPACING;
+				}
+				if (depth == nrVertices - 1) {
+					z = zpos + (depth - 2) * SPACING;
+				}
+				if (width == 0) {
+					x = xpos + (width + 0) * SPACING;
+				}
+				if (width == nrVertices - 1) {
+					x = xpos + (width - 2) * SPACING;
+				}
+
+				if (depth == 0 || depth == nrVertices - 1 || width == 0 || width == nrVertices - 1) //edges of grid ie. skirts
+				{
+					glm::vec3 pos{ x, skirtDepth, z };
+					grid[index(width, depth)] = { pos };
+				}
+				else if (sides != nullptr && (depth == 1 || depth == nrVertices - 2 || width == 1 || width == nrVertices - 2)) //sides are shared with the neighbors
+				{
+					glm::vec3 pos{ x, sideHeight(sides, width - 1, depth - 1), z };
+					bandMinY[band] = std::min(bandMinY[band], pos.y);
+					bandMaxY[band] = std::max(bandMaxY[band], pos.y);
+					grid[index(width, depth)] = { pos };
+				}
+				else //Non edges compute noise value for the y-component
+				{
+					auto pos = createPointWithNoise(x, z, &bandMinY[band], &bandMaxY[band]);
+					grid[index(width, depth)] = { pos };
+				}
 			}
 		}
-	}
+	});
+	minY = *std::min_element(bandMinY.begin(), bandMinY.end());
+	maxY = *std::max_element(bandMaxY.begin(), bandMaxY.end());
+	//The culler and the below ground test rely on the estimate
+	assert(minY >= heights.first && maxY <= heights.second && "height estimate is not conservative");
 	/*** Compute edge & skirt normals ***/
 	//Top row, visit each column
 	int depth = 1;
 	for (int width = 1; width < nrVertices - 1; ++width) {
-		glm::vec3 v0 = vertices[index(width, depth)].position; //current vertex
+		glm::vec3 v0 = grid[index(width, depth)].position; //current vertex
 		glm::vec3 ne, n, nw, w, sw, s, se, e;
 		//Find all surrounding vertices 
 
 		//NE och SW behvs ej
-		s = vertices[index(width, depth + 1)].position;
+		s = grid[index(width, depth + 1)].position;
 		nw = createFakeVertex(width - 1, depth - 1);
 		n = createFakeVertex(width, depth - 1);
 		ne = createFakeVertex(width + 1, depth - 1);
@@ -224,470 +562,1108 @@ ChunkHandler::Chunk::Chunk(unsigned int _nrVertices, unsigned int _lod, float xp
 			sw = createFakeVertex(width - 1, depth + 1);
 		}
 		else {
-			w = vertices[index(width - 1, depth)].position;
-			sw = vertices[index(width - 1, depth + 1)].position;
+			w = grid[index(width - 1, depth)].position;
+			sw = grid[index(width - 1, depth + 1)].position;
 		}
 		if (width == nrVertices - 2) { //top rightmost vertex 
 			e = createFakeVertex(width + 1, depth);
 			se = createFakeVertex(width + 1, depth + 1);
 		}
 		else {
-			e = vertices[index(width + 1, depth)].position;
-			se = vertices[index(width + 1, depth + 1)].position;
+			e = grid[index(width + 1, depth)].position;
+			se = grid[index(width + 1, depth + 1)].position;
 		}
 		//compute normal 
-		std::vector<glm::vec3> neighbors{ ne, n, nw, w, sw, s, se, e };
+		std::array<glm::vec3, 8> neighbors{ ne, n, nw, w, sw, s, se, e };
 		glm::vec3 normal = computeNormal(neighbors, v0);
-		vertices[index(width, depth)].normal = normal;
-		vertices[index(width, depth - 1)].normal = normal; //n skirt
+		grid[index(width, depth)].normal = normal;
+		grid[index(width, depth - 1)].normal = normal; //n skirt
 		if (width == 1) {
-			vertices[index(width - 1, depth - 1)].normal = normal; //nw skirt
-			vertices[index(width - 1, depth)].normal = normal; //w skirt
+			grid[index(width - 1, depth - 1)].normal = normal; //nw skirt
+			grid[index(width - 1, depth)].normal = normal; //w skirt
 		}
 		if (width == nrVertices -2) {
-			vertices[index(width + 1, depth - 1)].normal = normal; //ne skirt
-			vertices[index(width + 1, depth)].normal = normal; //e skirt
+			grid[index(width + 1, depth - 1)].normal = normal; //ne skirt
+			grid[index(width + 1, depth)].normal = normal; //e skirt
 		}
 	} //End of top row
 
 	//Bottom row visit each column
 	depth = nrVertices - 2;
 	for (int width = 1; width < nrVertices - 1; ++width) {
-		glm::vec3 v0 = vertices[index(width, depth)].position; //current vertex
+		glm::vec3 v0 = grid[index(width, depth)].position; //current vertex
 		glm::vec3 ne, n, nw, w, sw, s, se, e;
 		//Find all surrounding vertices		
 		s = createFakeVertex(width, depth + 1);
 		sw = createFakeVertex(width - 1, depth + 1);
 		se = createFakeVertex(width + 1, depth + 1);
-		n = vertices[index(width, depth - 1)].position;
+		n = grid[index(width, depth - 1)].position;
 		if (width == 1) { //bottom leftmost vertex 
 			w = createFakeVertex(width - 1, depth);
 			nw = createFakeVertex(width - 1, depth - 1);
 		}
 		else {
-			w = vertices[index(width - 1, depth)].position;
-			nw = vertices[index(width - 1, depth - 1)].position;
+			w = grid[index(width - 1, depth)].position;
+			nw = grid[index(width - 1, depth - 1)].position;
 		}
 		if (width == nrVertices - 2) { //bottom rightmost vertex 
 			e = createFakeVertex(width + 1, depth);
 			ne = createFakeVertex(width + 1, depth - 1);
 		}
 		else {
-			e = vertices[index(width + 1, depth)].position;
-			ne = vertices[index(width + 1, depth - 1)].position;
+			e = grid[index(width + 1, depth)].position;
+			ne = grid[index(width + 1, depth - 1)].position;
 		}
 
 		//Compute normal
-		std::vector<glm::vec3> neighbors{ ne, n, nw, w, sw, s, se, e };
+		std::array<glm::vec3, 8> neighbors{ ne, n, nw, w, sw, s, se, e };
 		glm::vec3 normal = computeNormal(neighbors, v0);
-		vertices[index(width, depth)].normal = normal;
-		vertices[index(width, depth + 1)].normal = normal; //s skirt
+		grid[index(width, depth)].normal = normal;
+		grid[index(width, depth + 1)].normal = normal; //s skirt
 		if (width == 1) {
-			vertices[index(width - 1, depth + 1)].normal = normal; //sw skirt
-			vertices[index(width - 1, depth)].normal = normal; //w skirt
+			grid[index(width - 1, depth + 1)].normal = normal; //sw skirt
+			grid[index(width - 1, depth)].normal = normal; //w skirt
 		}
 		if (width == nrVertices - 2) {
-			vertices[index(width + 1, depth + 1)].normal = normal; //se skirt
-			vertices[index(width + 1, depth)].normal = normal; //e skirt
+			grid[index(width + 1, depth + 1)].normal = normal; //se skirt
+			grid[index(width + 1, depth)].normal = normal; //e skirt
 		}
 	}//End of bottom row
 
 	//Left column visit every row except top and bottom
 	int width = 1;
 	for (int depth = 2; depth < nrVertices - 2; ++depth) { //+2 - 2 range skips top and bottom row since they are already computed
-		glm::vec3 v0 = vertices[index(width, depth)].position; //current vertex
+		glm::vec3 v0 = grid[index(width, depth)].position; //current vertex
 		glm::vec3 ne, n, nw, w, sw, s, se, e;
 		//Find all surrounding vertices
-		n = vertices[index(width, depth - 1)].position;
-		ne = vertices[index(width + 1, depth - 1)].position;
-		e = vertices[index(width + 1, depth)].position;
-		se = vertices[index(width + 1, depth + 1)].position;
-		s = vertices[index(width, depth + 1)].position;
+		n = grid[index(width, depth - 1)].position;
+		ne = grid[index(width + 1, depth - 1)].position;
+		e = grid[index(width + 1, depth)].position;
+		se = grid[index(width + 1, depth + 1)].position;
+		s = grid[index(width, depth + 1)].position;
 
 		nw = createFakeVertex(width - 1, depth - 1);
 		w = createFakeVertex(width - 1, depth);
 		sw = createFakeVertex(width - 1, depth + 1);
 		//Compute normal
-		std::vector<glm::vec3> neighbors{ ne, n, nw, w, sw, s, se, e };
+		std::array<glm::vec3, 8> neighbors{ ne, n, nw, w, sw, s, se, e };
 		glm::vec3 normal = computeNormal(neighbors, v0);
-		vertices[index(width, depth)].normal = normal;
-		vertices[index(width - 1, depth)].normal = normal; //w skirt
+		grid[index(width, depth)].normal = normal;
+		grid[index(width - 1, depth)].normal = normal; //w skirt
 	}//End of left row
 
 	//Right column visit every row except top and bottom
 	width = nrVertices - 2;
 	for (int depth = 2; depth < nrVertices - 2; ++depth) { //+2 - 2 range skips top and bottom row since they are already computed
-		glm::vec3 v0 = vertices[index(width, depth)].position; //current vertex
+		glm::vec3 v0 = grid[index(width, depth)].position; //current vertex
 		glm::vec3 ne, n, nw, w, sw, s, se, e;
 		//Find all vertices
-		n = vertices[index(width, depth - 1)].position;
-		nw = vertices[index(width - 1, depth - 1)].position;
-		w = vertices[index(width - 1, depth)].position;
-		sw = vertices[index(width - 1, depth + 1)].position;
-		s = vertices[index(width, depth + 1)].position;
+		n = grid[index(width, depth - 1)].position;
+		nw = grid[index(width - 1, depth - 1)].position;
+		w = grid[index(width - 1, depth)].position;
+		sw = grid[index(width - 1, depth + 1)].position;
+		s = grid[index(width, depth + 1)].position;
 
 		e = createFakeVertex(width + 1, depth);
 		se = createFakeVertex(width + 1, depth + 1);
 		ne = createFakeVertex(width + 1, depth - 1);
 		//Compute normal
-		std::vector<glm::vec3> neighbors{ ne, n, nw, w, sw, s, se, e };
+		std::array<glm::vec3, 8> neighbors{ ne, n, nw, w, sw, s, se, e };
 		glm::vec3 normal = computeNormal(neighbors, v0);
-		vertices[index(width, depth)].normal = normal;
-		vertices[index(width + 1, depth)].normal = normal; //e skirt
+		grid[index(width, depth)].normal = normal;
+		grid[index(width + 1, depth)].normal = normal; //e skirt
 	}//End of right column
 
 	//Compute normal by weighting all connected triangles ignoring the first row/column + skirts
-	for (int depth = 2; depth < nrVertices - 2; ++depth)
-	{
-		for (int width = 2; width < nrVertices -2; ++width) {
-			glm::vec3 v0 = vertices[index(width, depth)].position; //current
-			//Retrieve neighboring points
-			glm::vec3 ne = vertices[index(width + 1, depth - 1)].position;
-			glm::vec3 n = vertices[index(width, depth - 1)].position;
-			glm::vec3 nw = vertices[index(width - 1, depth - 1)].position;
-			glm::vec3 w = vertices[index(width - 1, depth)].position;
-			glm::vec3 sw = vertices[index(width - 1, depth + 1)].position;
-			glm::vec3 s = vertices[index(width, depth + 1)].position;
-			glm::vec3 se = vertices[index(width + 1, depth + 1)].position;
-			glm::vec3 e = vertices[index(width + 1, depth)].position;
+	forRowBands(pool, nrVertices, [&](int, int firstRow, int endRow) {
+		for (int depth = std::max(firstRow, 2); depth < std::min(endRow, static_cast<int>(nrVertices) - 2); ++depth)
+		{
+			for (int width = 2; width < nrVertices -2; ++width) {
+				glm::vec3 v0 = grid[index(width, depth)].position; //current
+				//Retrieve neighboring points
+				glm::vec3 ne = grid[index(width + 1, depth - 1)].position;
+				glm::vec3 n = grid[index(width, depth - 1)].position;
+				glm::vec3 nw = grid[index(width - 1, depth - 1)].position;
+				glm::vec3 w = grid[index(width - 1, depth)].position;
+				glm::vec3 sw = grid[index(width - 1, depth + 1)].position;
+				glm::vec3 s = grid[index(width, depth + 1)].position;
+				glm::vec3 se = grid[index(width + 1, depth + 1)].position;
+				glm::vec3 e = grid[index(width + 1, depth)].position;
+
+				std::array<glm::vec3, 8> neighbors{ ne, n, nw, w, sw, s, se, e };
+
+				glm::vec3 normal = computeNormal(neighbors, v0);
+				grid[index(width, depth)].normal = normal;
+			}
+		}
+	});
 
-			std::vector<glm::vec3> neighbors{ ne, n, nw, w, sw, s, se, e };
+	packGrid(grid, minY, maxY, pool);
+}
 
-			glm::vec3 normal = computeNormal(neighbors, v0);
-			vertices[index(width, depth)].normal = normal;
+ChunkHandler::Chunk::Grid ChunkHandler::Chunk::sampleGrid(float& minY, float& maxY, WorkerPool* pool, const ChunkSides* sides) const {
+	int size = static_cast<int>(nrVertices);
+	int span = size - 3;
+	int cells = span / step;
+
+	//Heights of the step lattice with one ring outside the chunk for the normals, lattice point i, j is at vertex i * step, j * step
+	int side = cells + 3;
+	ScratchVector<glm::vec3> lattice(side * side);
+	ScratchVector<float> bandMinY(rowBandCount(side), minY), bandMaxY(rowBandCount(side), maxY);
+	forRowBands(pool, side, [&](int band, int firstRow, int endRow) {
+		for (int j = firstRow - 1; j < endRow - 1; ++j) {
+			for (int i = -1; i <= cells + 1; ++i) {
+				float x = XPOS + i * step * SPACING;
+				float z = ZPOS + j * step * SPACING;
+				bool inside = i >= 0 && j >= 0 && i <= cells && j <= cells;
+				bool onSide = inside && (i == 0 || j == 0 || i == cells || j == cells);
+				glm::vec3& point = lattice[(i + 1) + side * (j + 1)];
+				point = onSide ? glm::vec3{ x, sideHeight(sides, i * step, j * step), z } : createPointWithNoise(x, z);
+				if (inside) {
+					bandMinY[band] = std::min(bandMinY[band], point.y);
+					bandMaxY[band] = std::max(bandMaxY[band], point.y);
+				}
+			}
+		}
+	});
+	minY = *std::min_element(bandMinY.begin(), bandMinY.end());
+	maxY = *std::max_element(bandMaxY.begin(), bandMaxY.end());
+	auto point = [&](int i, int j) { return lattice[(i + 1) + side * (j + 1)]; };
+
+	ScratchVector<glm::vec3> normals((cells + 1) * (cells + 1));
+	forRowBands(pool, cells + 1, [&](int, int firstRow, int endRow) {
+		for (int j = firstRow; j < endRow; ++j) {
+			for (int i = 0; i <= cells; ++i) {
+				std::array<glm::vec3, 8> neighbors{ point(i + 1, j - 1), point(i, j - 1), point(i - 1, j - 1), point(i - 1, j),
+					point(i - 1, j + 1), point(i, j + 1), point(i + 1, j + 1), point(i + 1, j) };
+				normals[i + (cells + 1) * j] = computeNormal(neighbors, point(i, j));
+			}
 		}
+	});
+	auto normal = [&](int i, int j) { return normals[i + (cells + 1) * j]; };
+
+	//Vertices between the samples are never drawn
+	Grid grid(nrVertices * nrVertices, Vertex{ glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f } });
+	for (int j = 0; j <= cells; ++j) {
+		for (int i = 0; i <= cells; ++i)
+			grid[index(i * step + 1, j * step + 1)] = { point(i, j), normal(i, j) };
 	}
 
-	//mesh = Mesh{ vertices, indices }; 
+	//The sides are sampled at full resolution so finer neighbors can be stitched to them, with the same heights the neighbors have
+	auto sampleSide = [&](int x, int z, const glm::vec3& n0, const glm::vec3& n1, float t) {
+		float y = sideHeight(sides, x, z);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		grid[index(x + 1, z + 1)] = { { XPOS + x * SPACING, y, ZPOS + z * SPACING }, glm::normalize(n0 + (n1 - n0) * t) };
+	};
+	for (int k = 0; k < span; ++k) {
+		if (k % step == 0)
+			continue;
+		int i = k / step;
+		float t = static_cast<float>(k % step) / step;
+		sampleSide(k, 0, normal(i, 0), normal(i + 1, 0), t); //north
+		sampleSide(k, span, normal(i, cells), normal(i + 1, cells), t); //south
+		sampleSide(0, k, normal(0, i), normal(0, i + 1), t); //west
+		sampleSide(span, k, normal(cells, i), normal(cells, i + 1), t); //east
+	}
+
+	//Skirts share position and normal with the side vertex next to them
+	for (int depth = 0; depth < size; ++depth) {
+		for (int width = 0; width < size; ++width) {
+			if (depth != 0 && depth != size - 1 && width != 0 && width != size - 1)
+				continue;
+			const Vertex& next = grid[index(std::clamp(width, 1, size - 2), std::clamp(depth, 1, size - 2))];
+			grid[index(width, depth)] = { { next.position.x, skirtDepth, next.position.z }, next.normal };
+		}
+	}
+	return grid;
+}
 
+void ChunkHandler::Chunk::packGrid(const Grid& grid, float minY, float maxY, WorkerPool* pool) {
 	//create boundingbox ignoring the extra row and column added by the skirts
 	//max x and z already had size - 1 before skirts were added 
-	float minX = xpos;
-	float maxX = xpos + (nrVertices - 3) * SPACING;
-	float minZ = zpos;
-	float maxZ = zpos + (nrVertices - 3) * SPACING;
+	float minX = XPOS;
+	float maxX = XPOS + (nrVertices - 3) * SPACING;
+	float minZ = ZPOS;
+	float maxZ = ZPOS + (nrVertices - 3) * SPACING;
+
+	bounds = AABB{ { minX, minY, minZ }, { maxX, maxY, maxZ } };
+
+	computeLodErrors(grid);
+	computeOccluderHeights(grid);
+	computePatchHeights(grid);
+	computeNodeHeights(grid);
+
+	/*** Pack vertices now that the height range of the chunk is known ***/
+	minHeight = minY;
+	maxHeight = maxY;
+	vertices.resize(nrVertices * nrVertices);
+	forRowBands(pool, nrVertices, [&](int, int firstRow, int endRow) {
+			for (int depth = firstRow; depth < endRow; ++depth) {
+				for (int width = 0; width < nrVertices; ++width) {
+					vertices[index(width, depth)] = packVertex(grid[index(width, depth)], width, depth);
+				}
+			}
+	});
 
-	//Important theese are given in correct order -> see BoundingBox.h ctor
-	points = std::vector<glm::vec3>{ { minX, maxY, minZ }, { maxX, maxY, minZ }, { maxX, maxY, maxZ }, { minX, maxY, maxZ },
-				{ minX, minY, minZ }, { maxX, minY, minZ }, { maxX, minY, maxZ }, { minX, minY, maxZ } };
+	//The estimate is conservative, chunks it missed are still shared if they packed to the flat grid.
+	//A coarse chunk knows nothing between its samples, so it is kept until it is generated at full resolution
+	if (step == 1 && maxY <= TerrainNoise::groundLevel && std::all_of(vertices.begin(), vertices.end(),
+		[](const TerrainVertex& v) { return v.normal[0] == 0 && v.normal[1] == 0; })) {
+		makeFlat();
+	}
 }
 
-chunkChecker ChunkHandler::Chunk::checkMovement(const glm::vec3& pos)
+void ChunkHandler::useAdaptiveMeshing(bool use)
 {
-	chunkChecker cc = inside;
-	auto v1 = mesh.vertices[0].position; //first vertex in chunk
-	auto v2 = mesh.vertices[mesh.vertices.size() - 1].position; // last vertex in chunk
-
-	//Check if position is within chunk borders spanned by v1 and v2 in the x,z plane
-	if (pos.z < v1.z) {
-		cc = up;
-		return cc;
+	if (use == adaptiveMeshing)
+		return;
+
+	adaptiveMeshing = use;
+	flatMesh.setElementBuffer(use ? flatAdaptiveIndices.getEBO() : lodIndices.getEBO());
+	for (auto& [coord, chunk] : chunks)
+		chunk->useAdaptiveIndices(use, lodIndices);
+
+	// Chunks without adaptive sets keep the regular ones until theirs are built, nearest first.
+	// Sets already building are still given to their chunks, they are used once adaptive meshing is turned on again
+	for (const ChunkCoord& coord : adaptiveQueue)
+		adaptiveRequested.erase(coord);
+	adaptiveQueue.clear();
+	if (use) {
+		std::vector<const Chunk*> waiting;
+		for (auto& [coord, chunk] : chunks) {
+			if (chunk->needsAdaptiveIndices())
+				waiting.push_back(chunk);
+		}
+		auto distance = [this](const Chunk* chunk) {
+			int dx = chunk->coord.x - center.x, dz = chunk->coord.z - center.z;
+			return dx * dx + dz * dz;
+		};
+		std::sort(waiting.begin(), waiting.end(), [&](const Chunk* a, const Chunk* b) { return distance(a) < distance(b); });
+		for (const Chunk* chunk : waiting)
+			requestAdaptiveIndices(chunk);
 	}
-	if (pos.z > v2.z) {
-		cc = down;
-		return cc;
+}
+
+void ChunkHandler::useCdlod(bool use)
+{
+	if (use == cdlodMode)
+		return;
+
+	cdlodMode = use;
+	if (use && !cdlodCreated) {
+		//Room for every chunk in the circle, chunks that left it are deleted before new ones are added
+		cdlod = CdlodTerrain{ nrVertices, spacing, gridSize * gridSize, Chunk::flatVertices(nrVertices) };
+		cdlodCreated = true;
+		//Read back once, the layer then holds the vertices and the mesh is released without reading them again
+		for (auto& [coord, chunk] : chunks) {
+			chunk->restoreGeometry();
+			chunk->uploadHeights(cdlod);
+		}
 	}
-	if (pos.x < v1.x) {
-		cc = left;
-		return cc;
+	for (auto& [coord, chunk] : chunks) {
+		if (use) {
+			chunk->releaseMesh();
+			releaseGeometry(chunk);
+		}
+		else {
+			chunk->bakeMeshes(lodIndices, flatMesh, flatAdaptiveIndices, adaptiveMeshing);
+			releaseGeometry(chunk);
+		}
 	}
-	if (pos.x > v2.x) {
-		cc = right;
-		return cc;
+}
+
+void ChunkHandler::useFarField(bool use)
+{
+	if (use == farFieldMode)
+		return;
+
+	farFieldMode = use;
+	if (use && !farFieldCreated) {
+		//The finest level must reach past the kept chunks around the chunk the camera is over, plus a margin for snapping
+		float width = (nrVertices - 1) * spacing;
+		unsigned int cells = 2 * ((gridSize / 2 + 1) * farFieldCellsPerChunk + 3);
+		farField = GeometryClipmap{ cells, width / farFieldCellsPerChunk, origin, skirtDepth };
+		farFieldCreated = true;
+
+		//Every level is computed at first, from where the camera was last frame, the next update scrolls them to where it is
+		glm::vec3 camPos;
+		{
+			std::lock_guard<std::mutex> lock(mu);	// Thread safe
+			camPos = jobCamPos;
+		}
+		generator.push([this, camPos] {
+			unsigned int computed = farField.fill(camPos);
+			std::lock_guard<std::mutex> lock(mu);	// Thread safe
+			farFieldFilled = true;
+			farFieldFillHeights = computed;
+		});
 	}
-	//Position is inside borders
-	return cc;
 }
 
-std::pair<glm::vec3, glm::vec3> ChunkHandler::Chunk::computePN(const glm::vec3& n) const
+void ChunkHandler::keepChunkGeometry(bool keep)
 {
-	if (n.x > 0 && n.y > 0 && n.z > 0) { // + + +
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(2), boundingBox.getPoint(4)};
+	if (keep == keepGeometry)
+		return;
+
+	keepGeometry = keep;
+	for (auto& [coord, chunk] : chunks) {
+		if (keep)
+			chunk->restoreGeometry();
+		else
+			releaseGeometry(chunk);
 	}
-	if (n.x > 0 && n.y > 0 && n.z < 0) { // + + -
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(1), boundingBox.getPoint(7)};
+}
+
+void ChunkHandler::draw(const glm::vec3& camposition, const Shader& shader)
+{
+	if (cdlodMode) {
+		drawCdlod(camposition, shader, pixelTolerance * lodScale);
 	}
-	if (n.x > 0 && n.y < 0 && n.z > 0) { // + - +
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(6), boundingBox.getPoint(0)};
+	else {
+		culler.update(camposition, { pixelsPerUnit, pixelTolerance * lodScale, lodHysteresis, spacing });
+		drawChunks(shader);
 	}
-	if (n.x > 0 && n.y < 0 && n.z < 0) { // + - - 
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(5), boundingBox.getPoint(3)};
+	if (farFieldMode && farFieldReady)
+		drawFarField(shader);
+}
+
+void ChunkHandler::drawWithoutLOD(const glm::vec3& camposition, const Shader& shader)
+{
+	if (cdlodMode) {
+		//Ranges that put every node in view at lod 1
+		drawCdlod(glm::vec3{ 0.0f }, shader, 1e-6f);
 	}
-	if (n.x < 0 && n.y > 0 && n.z > 0) { // - +  +
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(3), boundingBox.getPoint(5)};
+	else {
+		ChunkCuller::LodParameters params{ pixelsPerUnit, pixelTolerance * lodScale, lodHysteresis, spacing };
+		params.fixedLod = 1;
+		culler.update(camposition, params);
+		drawChunks(shader);
 	}
-	if (n.x < 0 && n.y > 0 && n.z < 0) { // - + -
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(0), boundingBox.getPoint(6)};
+	if (farFieldMode && farFieldReady)
+		drawFarField(shader);
+}
+
+void ChunkHandler::drawBoundingBox()
+{
+	//12 edges per box, each edge joins two corners that differ in one axis
+	boxLines.clear();
+	auto addBox = [this](const AABB& bounds) {
+		for (unsigned int corner = 0; corner < 8; ++corner) {
+			for (unsigned int axis = 1; axis < 8; axis *= 2) {
+				if (!(corner & axis)) {
+					boxLines.push_back(bounds.getCorner(corner));
+					boxLines.push_back(bounds.getCorner(corner | axis));
+				}
+			}
+		}
+	};
+	//The chunks the last draw selected, the culler's draw list is not updated in CDLOD mode and may hold deleted chunks
+	if (cdlodMode) {
+		for (const auto& [coord, chunk] : chunks) {
+			if (withinRadius(coord, drawRings) && culler.inFrustum(chunk->getBounds()))
+				addBox(chunk->getBounds());
+		}
 	}
-	if (n.x < 0 && n.y < 0 && n.z > 0) { // - - +
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(7), boundingBox.getPoint(1)};
+	else {
+		for (const ChunkCuller::DrawItem& item : culler.getDrawList()) {
+			const Chunk* chunk = slotChunks[item.slot];
+			if (chunk != nullptr && withinRadius(chunk->coord, drawRings))
+				addBox(chunk->getBounds());
+		}
 	}
-	if (n.x < 0 && n.y < 0 && n.z < 0) { // - - -
-		return std::pair<glm::vec3, glm::vec3>{boundingBox.getPoint(4), boundingBox.getPoint(2)};
+	if (boxLines.empty())
+		return;
+
+	if (boxVAO == 0) {
+		glGenVertexArrays(1, &boxVAO);
+		glGenBuffers(1, &boxVBO);
+		glBindVertexArray(boxVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
 	}
+	glBindVertexArray(boxVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+	glBufferData(GL_ARRAY_BUFFER, boxLines.size() * sizeof(glm::vec3), &boxLines[0], GL_STREAM_DRAW);
+	glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(boxLines.size()));
+	glBindVertexArray(0);
 }
 
-chunkChecker ChunkHandler::checkChunk(const glm::vec3& camPos)
+void ChunkHandler::drawChunks(const Shader& shader)
 {
-	return currentChunk->checkMovement(camPos);
+	stats.reset();
+	stats.cullNodesTested = culler.getNodesTested();
+	stats.cullPlaneTests = culler.getPlaneTests();
+	stats.chunksOccluded = culler.getOccludedChunks();
+	stats.patchesCulled = culler.getCulledPatches();
+	stats.cullReused = culler.reusedCulling();
+	stats.chunksResident = static_cast<unsigned int>(chunks.size());
+	stats.chunksCoarse = coarseChunks;
+	stats.chunksAllocated = chunkPool.getAllocated();
+	stats.fillTime = getFillTime();
+	takeJobStats();
+	for (const ChunkCuller::DrawItem& item : culler.getDrawList()) {
+		Chunk* chunk = slotChunks[item.slot];
+		if (!withinRadius(chunk->coord, drawRings))
+			continue;
+
+		int lod = item.lod;
+		if (adaptiveMeshing && chunk->hasAdaptiveIndices()) {
+			drawAdaptive(item, shader);
+		}
+		else if (item.patchMask != culler.allPatches()) {
+			drawPatches(item, shader);
+		}
+		else if (stitchEdges) {
+			int neighborLods[4];
+			for (int side = 0; side < 4; ++side) {
+				auto s = static_cast<ChunkIndexBuffer::Side>(side);
+				neighborLods[side] = neighborLOD(chunk, s);
+				stats.triangles += lodIndices.getEdgeRange(lod, s, neighborLods[side]).count / 3;
+			}
+			chunk->drawStitched(lod, neighborLods, shader, lodIndices);
+			stats.triangles += lodIndices.getCoreRange(lod).count / 3;
+		}
+		else {
+			chunk->draw(lod, shader, lodIndices);
+			stats.triangles += lodIndices.getRange(lod).count / 3;
+			stats.skirtTriangles += lodIndices.getSkirtTriangles(lod);
+		}
+		++stats.drawCalls;
+		++stats.chunksDrawn;
+		++stats.chunksPerLod[ChunkIndexBuffer::lodLevel(lod)];
+	}
 }
 
-/// <summary>
-/// Constructs a new chunk and adds it together with the movement (chunkChecker) that triggered the generation to the render queue. The chunk mesh is not initiated so it can be multi-threaded.
-/// </summary>
-/// <param name="newPos"></param>
-/// <param name="nrVeritices"></param>
-/// <param name="_spacing"></param>
-/// <param name="id"></param>
-/// <param name="inside"></param>
-void ChunkHandler::generateChunk(const std::pair<float, float>& newPos, unsigned int nrVeritices, float _spacing, unsigned int id, chunkChecker cc)
+void ChunkHandler::DrawRanges::add(const ChunkIndexBuffer::Range& range)
 {
-	Chunk* chunk = new Chunk{ nrVertices, 1, newPos.first, newPos.second, _spacing, id };
-	//std::future<Chunk*> ret = std::async();
-
-	renderQ.push({ chunk, cc });
+	// Patches follow each other in the element buffer, so neighboring visible patches become one range
+	if (size > 0 && offsets[size - 1] + counts[size - 1] * sizeof(unsigned int) == range.offset) {
+		counts[size - 1] += range.count;
+	}
+	else {
+		counts[size] = range.count;
+		offsets[size] = range.offset;
+		++size;
+	}
+	indices += range.count;
 }
 
-ChunkHandler::Chunk* ChunkHandler::Chunk::generateLOD(unsigned int nrVerticies, unsigned int _lod, float xpos, float zpos, float _spacing, unsigned int id) {
-	Chunk* chunkLOD = new Chunk{ nrVerticies, _lod, xpos, zpos, _spacing, id };
-	return chunkLOD;
+void ChunkHandler::drawPatches(const ChunkCuller::DrawItem& item, const Shader& shader)
+{
+	DrawRanges ranges;
+	int lod = item.lod;
+	for (unsigned int patch = 0; patch < patchesPerSide * patchesPerSide; ++patch) {
+		if (item.patchMask & (1u << patch))
+			ranges.add(lodIndices.getPatchRange(lod, patch));
+	}
+	if (stitchEdges) {
+		for (int side = 0; side < 4; ++side) {
+			auto s = static_cast<ChunkIndexBuffer::Side>(side);
+			ranges.add(lodIndices.getEdgeRange(lod, s, neighborLOD(slotChunks[item.slot], s)));
+		}
+	}
+	else {
+		ranges.add(lodIndices.getBorderRange(lod));
+		stats.skirtTriangles += lodIndices.getSkirtTriangles(lod);
+	}
+	stats.triangles += ranges.indices / 3;
+	slotChunks[item.slot]->drawRanges(lod, ranges.counts, ranges.offsets, ranges.size, shader);
 }
 
-
-/// <summary>
-/// Updates which chunks that are rendered based on camera position. New chunks are genereted by multi-threading.
-/// </summary>
-/// <param name="camPos"></param>
-void ChunkHandler::updateChunks(const glm::vec3& camPos)
+void ChunkHandler::drawAdaptive(const ChunkCuller::DrawItem& item, const Shader& shader)
 {
-	// Checks movement and adds it to the move queue if outside the current chunk. Updates current chunk according to the camera position.
-	chunkChecker cc{ this->checkChunk(camPos) };	// Enum that hold if and which direction the camera moved 
-	switch (cc)
-	{
-	case chunkChecker::inside:
-		break;
-
-	case chunkChecker::up:
-
-		currentChunk = chunks[currentChunk->id - gridSize];
-		moveQ.push(cc);
-		break;
+	const AdaptiveIndexBuffer& adaptiveIndices = slotChunks[item.slot]->getAdaptiveIndices();
+	DrawRanges ranges;
+	int lod = item.lod;
+	if (item.patchMask == culler.allPatches()) {
+		ranges.add(adaptiveIndices.getRange(lod));
+		stats.skirtTriangles += adaptiveIndices.getSkirtTriangles(lod);
+	}
+	else {
+		for (unsigned int patch = 0; patch < patchesPerSide * patchesPerSide; ++patch) {
+			if (item.patchMask & (1u << patch))
+				ranges.add(adaptiveIndices.getPatchRange(lod, patch));
+		}
+		//The border range holds nothing but the skirts
+		const ChunkIndexBuffer::Range& border = adaptiveIndices.getBorderRange(lod);
+		ranges.add(border);
+		stats.skirtTriangles += border.count / 3;
+	}
+	stats.triangles += ranges.indices / 3;
+	slotChunks[item.slot]->drawRanges(lod, ranges.counts, ranges.offsets, ranges.size, shader);
+}
 
-	case chunkChecker::down:
+void ChunkHandler::drawCdlod(const glm::vec3& camPos, const Shader& shader, float cellPixels)
+{
+	stats.reset();
+	cdlod.setRanges(pixelsPerUnit, cellPixels);
+	cdlod.clear();
+	stats.chunksResident = static_cast<unsigned int>(chunks.size());
+	stats.chunksCoarse = coarseChunks;
+	stats.chunksAllocated = chunkPool.getAllocated();
+	stats.fillTime = getFillTime();
+	takeJobStats();
+	for (const auto& [coord, chunk] : chunks) {
+		if (!withinRadius(coord, drawRings) || !culler.inFrustum(chunk->getBounds()))
+			continue;
+		cdlod.selectNodes(chunk->getNodes(), camPos, culler);
+		++stats.chunksDrawn;
+	}
 
-		currentChunk = chunks[currentChunk->id + gridSize];
-		moveQ.push(cc);
-		break;
+	for (unsigned int level = 0; level < CdlodTerrain::levels; ++level)
+		shader.setVec3("lodColors[" + std::to_string(level) + "]", Chunk::setColorFromLOD(1 << level));
+	shader.setFloat("skirtDepth", skirtDepth);
+	stats.triangles = cdlod.draw(shader, camPos);
+	stats.drawCalls = cdlod.getDrawCalls();
+	stats.cdlodNodes = cdlod.getNodesSelected();
+}
 
-	case chunkChecker::left:
+void ChunkHandler::drawFarField(const Shader& shader)
+{
+	//One area per row of drawn chunks
+	float width = (nrVertices - 1) * spacing;
+	farField.clearHole();
+	for (int dz = -static_cast<int>(drawRings); dz <= static_cast<int>(drawRings); ++dz) {
+		int halfWidth = rowHalfWidth(dz, drawRings);
+		auto [x0, z0] = chunkPosition({ center.x - halfWidth, center.z + dz });
+		farField.addHole(glm::vec2{ x0, z0 }, glm::vec2{ x0 + (2 * halfWidth + 1) * width, z0 + width });
+	}
+	stats.farFieldTriangles = farField.draw(shader, culler);
+	stats.triangles += stats.farFieldTriangles;
+	stats.drawCalls += farField.getDrawCalls();
+	stats.farFieldHeights = farFieldHeights;
+	farFieldHeights = 0;
+}
 
-		currentChunk = chunks[currentChunk->id - 1];
-		moveQ.push(cc);
-		break;
+void ChunkHandler::addChunk(Chunk* chunk)
+{
+	chunks[chunk->coord] = chunk;
+	slotChunks[chunk->id] = chunk;
+	updateCullData(chunk);
+}
 
-	case chunkChecker::right:
+void ChunkHandler::deleteChunk(Chunk* chunk)
+{
+	slotChunks[chunk->id] = nullptr;
+	culler.removeChunk(chunk->id);
+	if (cdlodCreated)
+		cdlod.releaseChunk(chunk->getHeightLayer());
+	chunk->recycle();
+	chunkPool.release(chunk);
+}
 
-		currentChunk = chunks[currentChunk->id + 1];
-		moveQ.push(cc);
-		break;
+ChunkHandler::ChunkPool::~ChunkPool()
+{
+	for (Chunk* block : blocks) {
+		for (unsigned int i = 0; i < blockSize; ++i)
+			block[i].~Chunk();
+		std::allocator<Chunk>{}.deallocate(block, blockSize);
 	}
+}
 
-	// MoveQ evaluator, only adds chunks to the render queue if all chunks from the previous move have been generated.
-	if (!moveQ.empty() && renderCounter == gridSize)
-	{
-		std::lock_guard<std::mutex> lock(mu);	// Thread safe
-
-		renderCounter = 0;
-		std::vector<unsigned int> ids;
+ChunkHandler::Chunk* ChunkHandler::ChunkPool::acquire()
+{
+	std::lock_guard<std::mutex> lock(mu);
+	if (freeChunks.empty()) {
+		Chunk* block = std::allocator<Chunk>{}.allocate(blockSize);
+		for (unsigned int i = 0; i < blockSize; ++i)
+			new (block + i) Chunk{ nrVertices, spacing };
+		blocks.push_back(block);
+		//Handed out from the front of the block
+		for (unsigned int i = blockSize; i-- > 0;)
+			freeChunks.push_back(block + i);
+	}
+	Chunk* chunk = freeChunks.back();
+	freeChunks.pop_back();
+	if (!chunk->hasStorage() && !freeVertices.empty()) {
+		chunk->setStorage(std::move(freeVertices.back()));
+		freeVertices.pop_back();
+	}
+	return chunk;
+}
 
-		chunkChecker cc = moveQ.front();
-		moveQ.pop();
-		
-		int row, col;
-		switch (cc)
-		{
-		case chunkChecker::up:
-			row = 0;
-			for (col = 0; col < gridSize; ++col) {
-				ids.push_back(index(col, row, gridSize));
-			}
-			break;
+void ChunkHandler::ChunkPool::release(Chunk* chunk)
+{
+	std::lock_guard<std::mutex> lock(mu);
+	freeChunks.push_back(chunk);
+}
 
-		case chunkChecker::down:
-			row = gridSize - 1;
-			for(col = 0; col < gridSize; ++col) {
-				ids.push_back(index(col, row, gridSize));
-			}
-			break;
+void ChunkHandler::ChunkPool::releaseVertices(std::vector<TerrainVertex>&& storage)
+{
+	if (storage.capacity() == 0)
+		return;
+	std::lock_guard<std::mutex> lock(mu);
+	//Storage beyond that is freed, it was only needed while every chunk kept its vertices
+	if (freeVertices.size() < maxFreeVertices)
+		freeVertices.push_back(std::move(storage));
+}
 
-		case chunkChecker::left:
-			col = 0;
-			for(row = 0; row < gridSize; ++row) {
-				ids.push_back(index(col, row, gridSize));
-			}
-			break;
+unsigned int ChunkHandler::ChunkPool::getAllocated() const
+{
+	std::lock_guard<std::mutex> lock(mu);
+	return static_cast<unsigned int>(blocks.size()) * blockSize;
+}
 
-		case chunkChecker::right:
-			col = gridSize - 1;
-			for(row = 0; row < gridSize; ++row) {
-				ids.push_back(index(col, row, gridSize));
-			}
-			break;
-		}
+void ChunkHandler::releaseGeometry(Chunk* chunk)
+{
+	if (!keepGeometry)
+		chunkPool.releaseVertices(chunk->releaseGeometry());
+}
 
-		// Multi-threading
-		for (auto id : ids)
-		{
-			auto newPos = newChunkPosition(cc, id);
-			std::thread t(&ChunkHandler::generateChunk, this, newPos, nrVertices, spacing, id, cc);
-			t.detach();
-		}
-	}
+void ChunkHandler::updateCullData(const Chunk* chunk)
+{
+	culler.setChunk(chunk->id, { chunk->getBounds(), chunk->getLodErrors(), chunk->getOccluderHeights(),
+		chunk->getPatchMinHeights(), chunk->getPatchMaxHeights(), chunk->getStep() });
+}
 
-	// Swaps chunks in the chunks grid when a new chunk has been rendered. Updates all chunk ids to match it's position in the chunks grid.
-	while (!renderQ.empty()) 
+int ChunkHandler::neighborLOD(const Chunk* chunk, ChunkIndexBuffer::Side side)
+{
+	ChunkCoord coord = chunk->coord;
+	switch (side)
 	{
-		std::lock_guard<std::mutex> lock(mu);	// Thread safe
-
-		chunkInfo ci = renderQ.front();	// <Chunk*, chunkChecker>
-		renderQ.pop();
-		++renderCounter;
-		
-		Chunk* newChunk = std::get<Chunk*>(ci);
-		newChunk->bakeMeshes();
-
-		Chunk* temp;
-		unsigned int id = newChunk->id;
-
-		int row, col;
-		switch (std::get<chunkChecker>(ci))
-		{
-		case chunkChecker::up:
-			temp = chunks[id + gridSize * (gridSize - 1)];	// Chunk to be deleted
-
-			col = id;
-			for (row = gridSize - 1; row > 0; --row) {
+	case ChunkIndexBuffer::north:
+		--coord.z;
+		break;
+	case ChunkIndexBuffer::south:
+		++coord.z;
+		break;
+	case ChunkIndexBuffer::west:
+		--coord.x;
+		break;
+	case ChunkIndexBuffer::east:
+		++coord.x;
+		break;
+	}
+	auto neighbor = chunks.find(coord);
+	if (neighbor == chunks.end())
+		return culler.getLod(chunk->id);
+	return culler.getLod(neighbor->second->id);
+}
 
-				chunks[index(col, row, gridSize)] = chunks[index(col, row - 1, gridSize)];
-				chunks[index(col, row, gridSize)]->id += gridSize;
-			}
+ChunkHandler::ChunkCoord ChunkHandler::chunkCoord(const glm::vec3& pos) const
+{
+	float width = (nrVertices - 1) * spacing;
+	return { static_cast<int>(std::floor((pos.x - origin.x) / width)), static_cast<int>(std::floor((pos.z - origin.y) / width)) };
+}
 
-			chunks[id] = newChunk;
-			delete temp;
-			temp = nullptr;
+std::pair<float, float> ChunkHandler::chunkPosition(const ChunkCoord& coord) const
+{
+	float width = (nrVertices - 1) * spacing;
+	return { origin.x + coord.x * width, origin.y + coord.z * width };
+}
 
-			break;
+unsigned int ChunkHandler::slot(const ChunkCoord& coord) const
+{
+	int size = static_cast<int>(gridSize);
+	int col = ((coord.x % size) + size) % size;
+	int row = ((coord.z % size) + size) % size;
+	return col + gridSize * row;
+}
 
-		case chunkChecker::down:
-			col = id % gridSize;
-			temp = chunks[col];	// Chunk to be deleted
+int ChunkHandler::rowHalfWidth(int dz, unsigned int radius) const
+{
+	//(radius + 0.5)^2 rounded down, distances are whole chunks
+	int limit = static_cast<int>(radius * (radius + 1));
+	int halfWidth = -1;
+	while ((halfWidth + 1) * (halfWidth + 1) + dz * dz <= limit)
+		++halfWidth;
+	return halfWidth;
+}
 
-			for (row = 0; row < gridSize - 1; ++row) {
+bool ChunkHandler::withinRadius(const ChunkCoord& coord, unsigned int radius) const
+{
+	int dx = coord.x - center.x, dz = coord.z - center.z;
+	return dx * dx + dz * dz <= static_cast<int>(radius * (radius + 1));
+}
 
-				chunks[index(col, row, gridSize)] = chunks[index(col, row + 1, gridSize)];
-				chunks[index(col, row, gridSize)]->id -= gridSize;
-			}
+/// <summary>
+/// Constructs a new chunk and adds it to the render queue. The chunk mesh is not initiated so it can be multi-threaded.
+/// </summary>
+/// <param name="coord"></param>
+/// <param name="adaptive"></param>
+/// <param name="heights">see Chunk::generate</param>
+/// <param name="belowGround">see Chunk::generate</param>
+void ChunkHandler::generateChunk(ChunkCoord coord, unsigned int step, bool adaptive, const std::pair<float, float>& heights, bool belowGround)
+{
+	auto [xpos, zpos] = chunkPosition(coord);
+	// Sides are shared with the neighbors, chunks below ground level come out flat without them
+	ChunkSides sides;
+	if (!belowGround)
+		generator.parallelFor(4, [&](unsigned int side) { sides[side] = seamHeights(coord, static_cast<ChunkIndexBuffer::Side>(side)); });
+	// The rows of the chunk are split over the workers that are free, so the nearest chunks are done sooner
+	Chunk* chunk = chunkPool.acquire();
+	chunk->generate(xpos, zpos, slot(coord), step, &generator, belowGround ? nullptr : &sides, heights, belowGround);
+	chunk->coord = coord;
+	bool buildAdaptive = adaptive && chunk->needsAdaptiveIndices();
+	auto adaptiveStart = std::chrono::steady_clock::now();
+	if (buildAdaptive)
+		chunk->buildAdaptiveIndices(&generator);
+	float adaptiveTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - adaptiveStart).count();
+
+	std::lock_guard<std::mutex> lock(mu);	// Thread safe
+	renderQ.push(chunk);
+	if (buildAdaptive) {
+		++adaptiveBuilds;
+		adaptiveBuildTime += adaptiveTime;
+	}
+}
 
-			chunks[id] = newChunk;
-			delete temp;
-			temp = nullptr;
+std::shared_ptr<const std::vector<float>> ChunkHandler::seamHeights(const ChunkCoord& coord, ChunkIndexBuffer::Side side)
+{
+	// A seam is kept with the chunk north or west of it
+	bool alongZ = side == ChunkIndexBuffer::west || side == ChunkIndexBuffer::east;
+	ChunkCoord owner = coord;
+	if (side == ChunkIndexBuffer::north)
+		--owner.z;
+	if (side == ChunkIndexBuffer::west)
+		--owner.x;
+	auto& table = seams[alongZ ? 0 : 1];
+	{
+		std::lock_guard<std::mutex> lock(seamMu);
+		auto found = table.find(owner);
+		if (found != table.end())
+			return found->second;
+	}
 
-			break;
+	// The seam lies on the origin of the next chunk and ends there, the chunks do not add up their widths the same way
+	unsigned int span = nrVertices - 1;
+	auto [x0, z0] = chunkPosition(owner);
+	auto [x1, z1] = chunkPosition({ owner.x + 1, owner.z + 1 });
+	auto heights = std::make_shared<std::vector<float>>(span + 1);
+	for (unsigned int k = 0; k <= span; ++k) {
+		if (alongZ)
+			(*heights)[k] = TerrainNoise::height(x1, k == span ? z1 : z0 + k * spacing);
+		else
+			(*heights)[k] = TerrainNoise::height(k == span ? x1 : x0 + k * spacing, z1);
+	}
 
-		case chunkChecker::left:
-			temp = chunks[id + gridSize - 1];	// Chunk to be deleted
+	// The chunk on the other side may have sampled the seam meanwhile, the heights are the same
+	std::lock_guard<std::mutex> lock(seamMu);
+	return table.emplace(owner, std::move(heights)).first->second;
+}
 
-			row = id / gridSize;
-			for (col = gridSize - 1; col > 0; --col) {
+void ChunkHandler::pruneSeams()
+{
+	std::lock_guard<std::mutex> lock(seamMu);
+	for (int alongZ = 0; alongZ < 2; ++alongZ) {
+		for (auto it = seams[alongZ].begin(); it != seams[alongZ].end();) {
+			ChunkCoord other{ it->first.x + (alongZ == 0 ? 1 : 0), it->first.z + (alongZ == 0 ? 0 : 1) };
+			if (withinRadius(it->first, residencyRadius) || withinRadius(other, residencyRadius))
+				++it;
+			else
+				it = seams[alongZ].erase(it);
+		}
+	}
+}
 
-				chunks[index(col, row, gridSize)] = chunks[index(col - 1, row, gridSize)];
-				++chunks[index(col, row, gridSize)]->id;
-			}
+void ChunkHandler::requestAdaptiveIndices(const Chunk* chunk)
+{
+	if (adaptiveMeshing && chunk->needsAdaptiveIndices() && adaptiveRequested.insert(chunk->coord).second)
+		adaptiveQueue.push_back(chunk->coord);
+}
 
-			chunks[id] = newChunk;
-			delete temp;
-			temp = nullptr;
+void ChunkHandler::updateAdaptiveIndices()
+{
+	std::list<AdaptiveJob> finished;
+	{
+		std::lock_guard<std::mutex> lock(mu);	// Thread safe
+		for (auto it = adaptiveJobs.begin(); it != adaptiveJobs.end();) {
+			auto next = std::next(it);
+			if (it->done)
+				finished.splice(finished.end(), adaptiveJobs, it);
+			it = next;
+		}
+	}
+	for (AdaptiveJob& job : finished) {
+		adaptiveRequested.erase(job.coord);
+		auto kept = chunks.find(job.coord);
+		if (kept != chunks.end() && kept->second->needsAdaptiveIndices()) {
+			kept->second->setAdaptiveIndices(std::move(job.indices));
+			kept->second->useAdaptiveIndices(adaptiveMeshing, lodIndices);
+		}
+	}
 
-			break;
+	while (adaptiveMeshing && !adaptiveQueue.empty() && adaptiveJobs.size() < maxAdaptiveJobs) {
+		ChunkCoord coord = adaptiveQueue.front();
+		adaptiveQueue.pop_front();
+		auto kept = chunks.find(coord);
+		if (kept == chunks.end() || !kept->second->needsAdaptiveIndices()) {
+			adaptiveRequested.erase(coord);
+			continue;
+		}
+		adaptiveJobs.emplace_back();
+		AdaptiveJob& job = adaptiveJobs.back();
+		job.coord = coord;
+		job.heights.resize(nrVertices * nrVertices);
+		kept->second->decodeHeights(job.heights.data());
+		std::copy_n(kept->second->getLodErrors(), 5, job.lodErrors);
+		generator.push([this, &job] {
+			auto start = std::chrono::steady_clock::now();
+			AdaptiveIndexBuffer indices{ job.heights.data(), nrVertices, 16, patchesPerSide, job.lodErrors, &generator };
+			float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+			std::lock_guard<std::mutex> lock(mu);	// Thread safe
+			job.indices = std::move(indices);
+			job.done = true;
+			++adaptiveBuilds;
+			adaptiveBuildTime += time;
+		});
+	}
+}
 
-		case chunkChecker::right:
-			temp = chunks[id - gridSize + 1];	// Chunk to be deleted
+void ChunkHandler::takeJobStats()
+{
+	std::lock_guard<std::mutex> lock(mu);
+	stats.jobsFinished = jobsFinished;
+	stats.jobTime = jobTime;
+	stats.adaptiveBuilds = adaptiveBuilds;
+	stats.adaptiveBuildTime = adaptiveBuildTime;
+	stats.adaptivePending = static_cast<unsigned int>(adaptiveRequested.size());
+	stats.jobScratchAllocations = jobScratch.allocations;
+	stats.jobScratchBytes = jobScratch.bytes;
+	stats.jobArenaBlocks = jobScratch.heapAllocations;
+	stats.jobHeapAllocations = static_cast<unsigned int>(jobHeapAllocations);
+	jobsFinished = 0;
+	jobTime = 0.0f;
+	adaptiveBuilds = 0;
+	adaptiveBuildTime = 0.0f;
+	jobScratch = ScratchArena::Counters{};
+	jobHeapAllocations = 0;
+}
 
-			row = id / gridSize;
-			for (col = 0; col < gridSize - 1; ++col) {
+void ChunkHandler::generateNextChunk()
+{
+	ChunkJob job;
+	glm::vec3 camPos;
+	float ranges[5];
+	{
+		std::lock_guard<std::mutex> lock(mu);	// Thread safe
+		// Every queued chunk has a job in the pool, those left after the queue was cleared find it empty
+		if (chunkJobs.empty() && refineJobs.empty())
+			return;
+		std::deque<ChunkJob>& jobs = chunkJobs.empty() ? refineJobs : chunkJobs;
+		job = jobs.front();
+		jobs.pop_front();
+		camPos = jobCamPos;
+		std::copy_n(jobStepRanges, 5, ranges);
+	}
+	// The step is picked from where the camera is when the chunk starts, not when it was queued.
+	// One height estimate per job picks it and tells if the chunk is below ground
+	auto start = std::chrono::steady_clock::now();
+	size_t heapStart = HeapCounter::local();
+	std::pair<float, float> pos = chunkPosition(job.coord);
+	std::pair<float, float> heights = Chunk::estimateHeights(pos.first, pos.second, nrVertices, spacing);
+	unsigned int step = std::min(job.maxStep, generationStep(estimateBounds(pos, heights), camPos, ranges));
+	ScratchArena::Scope scratch;
+	generateChunk(job.coord, step, job.adaptive, heights, Chunk::belowGround(pos.first, pos.second, nrVertices, spacing, heights));
+
+	ScratchArena::Counters used = scratch.used();
+	size_t heapAllocations = HeapCounter::local() - heapStart;
+	float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	std::lock_guard<std::mutex> lock(mu);
+	++jobsFinished;
+	jobTime += time;
+	jobScratch.allocations += used.allocations;
+	jobScratch.bytes += used.bytes;
+	jobScratch.heapAllocations += used.heapAllocations;
+	jobHeapAllocations += heapAllocations;
+}
 
-				chunks[index(col, row, gridSize)] = chunks[index(col + 1, row, gridSize)];
-				--chunks[index(col, row, gridSize)]->id;
-			}
+void ChunkHandler::requestChunks(const glm::vec3& camPos, bool nearestFirst)
+{
+	{
+		std::lock_guard<std::mutex> lock(mu);	// Thread safe
+		for (const ChunkJob& job : chunkJobs)
+			generating.erase(job.coord);
+		chunkJobs.clear();
+		// Refinements keep their order, those of chunks that left the circle are dropped
+		refineJobs.erase(std::remove_if(refineJobs.begin(), refineJobs.end(), [this](const ChunkJob& job) {
+			if (withinRadius(job.coord, residencyRadius))
+				return false;
+			refining.erase(job.coord);
+			return true;
+		}), refineJobs.end());
+	}
 
-			chunks[id] = newChunk;
-			delete temp;
-			temp = nullptr;
+	// Chunks in the frustum are started first and nearest first. Their heights are not known before they are generated, so the frustum test
+	// takes every height the terrain can reach and the distance is measured on the ground plane. The workers estimate the bounds of a chunk when they start it
+	float width = (nrVertices - 1) * spacing;
+	glm::vec2 camXZ{ camPos.x, camPos.z };
+	std::vector<std::pair<float, ChunkCoord>> order;
+	for (int dz = -static_cast<int>(residencyRadius); dz <= static_cast<int>(residencyRadius); ++dz) {
+		int halfWidth = rowHalfWidth(dz, residencyRadius);
+		for (int dx = -halfWidth; dx <= halfWidth; ++dx) {
+			ChunkCoord coord{ center.x + dx, center.z + dz };
+			if (chunks.count(coord) || generating.count(coord))
+				continue;
+			auto [x, z] = chunkPosition(coord);
+			glm::vec2 closest = glm::clamp(camXZ, glm::vec2{ x, z }, glm::vec2{ x + width, z + width });
+			float priority = glm::length(closest - camXZ);
+			AABB slab{ { x, TerrainNoise::groundLevel, z }, { x + width, TerrainNoise::maxHeight(), z + width } };
+			if (!nearestFirst && !culler.inFrustum(slab))
+				priority += std::numeric_limits<float>::max() / 2.0f;
+			order.push_back({ priority, coord });
+		}
+	}
+	std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
 
-			break;
+	// Multi-threading, the workers start the queued chunks in order
+	std::lock_guard<std::mutex> lock(mu);	// Thread safe
+	for (auto [priority, coord] : order)
+	{
+		generating.insert(coord);
+		chunkJobs.push_back({ coord, adaptiveMeshing, 16 });
+		generator.push([this] { generateNextChunk(); });
+	}
+}
 
-		default:
-			break;
+void ChunkHandler::requestRefinements(const glm::vec3& camPos)
+{
+	float ranges[5];
+	computeStepRanges(ranges);
+	std::vector<std::pair<float, ChunkJob>> order;
+	coarseChunks = 0;
+	for (const auto& [coord, chunk] : chunks) {
+		if (chunk->getStep() == 1)
+			continue;
+		++coarseChunks;
+		if (refining.count(coord))
+			continue;
+		unsigned int step = generationStep(chunk->getBounds(), camPos, ranges);
+		if (step < static_cast<unsigned int>(chunk->getStep())) {
+			const AABB& bounds = chunk->getBounds();
+			order.push_back({ glm::length(glm::clamp(camPos, bounds.min, bounds.max) - camPos), ChunkJob{ coord, adaptiveMeshing, step } });
 		}
 	}
+	if (order.empty())
+		return;
+	std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::lock_guard<std::mutex> lock(mu);	// Thread safe
+	for (const auto& [distance, job] : order)
+	{
+		refining.insert(job.coord);
+		refineJobs.push_back(job);
+		generator.push([this] { generateNextChunk(); });
+	}
 }
 
-void ChunkHandler::cullTerrainChunk(const std::vector<CameraPlane>& cameraPlanes)
+void ChunkHandler::computeStepRanges(float ranges[5]) const
 {
-	for (Chunk* chunk : chunks) {
-		bool outside = false, intersects = false;
+	ranges[0] = 0.0f;
+	for (unsigned int level = 1; level < 5; ++level) {
+		if (cdlodMode) //nodes are split into nodes of the finer level within its range
+			ranges[level] = cdlod.levelRange(level - 1, pixelsPerUnit, pixelTolerance * lodScale) / (1.0f - lodHysteresis);
+		else
+			ranges[level] = TerrainNoise::interpolationError((1u << level) * spacing) * pixelsPerUnit / (pixelTolerance * lodScale * (1.0f - lodHysteresis));
+	}
+}
 
+unsigned int ChunkHandler::generationStep(const AABB& bounds, const glm::vec3& camPos, const float ranges[5]) const
+{
+	float distance = glm::length(glm::clamp(camPos, bounds.min, bounds.max) - camPos);
+	unsigned int level = 4;
+	while (level > 0 && distance < ranges[level])
+		--level;
+	return 1u << level;
+}
 
-		for (const CameraPlane& plane : cameraPlanes) {
-			auto [p, n] = chunk->computePN(plane.normal);
-			float a = plane.evaluatePlane(n);
-			if (a > 0) // outside 
-			{
-				//chunk->drawChunk = false;
-				outside = true;
-				//std::cout << "Culling chunk \n";
-				break;
+/// <summary>
+/// Updates which chunks that are rendered based on camera position. New chunks are genereted by multi-threading.
+/// </summary>
+/// <param name="camPos"></param>
+void ChunkHandler::updateChunks(const glm::vec3& camPos)
+{
+	// Chunks are kept within a circle around the chunk the camera is over, when the camera moves to another chunk the circle follows.
+	// Chunks in both circles are kept however far the camera moved, so a jump only generates what is missing around the new position
+	ChunkCoord camChunk = chunkCoord(camPos);
+	if (!(camChunk == center)) {
+		bool jump = std::max(std::abs(camChunk.x - center.x), std::abs(camChunk.z - center.z)) > 1;
+		center = camChunk;
+		// The culler's quadtree starts at the corner of the grid around the circle, so neighboring chunks stay neighboring leaves
+		int half = static_cast<int>(gridSize / 2);
+		culler.setOrigin(slot({ center.x - half, center.z - half }));
+		for (auto it = chunks.begin(); it != chunks.end();) {
+			if (withinRadius(it->first, residencyRadius)) {
+				++it;
+			}
+			else {
+				deleteChunk(it->second);
+				it = chunks.erase(it);
 			}
+		}
+		pruneSeams();
+		if (jump) {
+			fillStart = std::chrono::steady_clock::now();
+			filling = true;
+		}
+		requestChunks(camPos, jump);
+	}
 
-			float b = plane.evaluatePlane(p);
-			if (b > 0) // intersects
-				intersects = true;
+	// Add the generated chunks, those that left the circle while they were generated are dropped
+	std::queue<Chunk*> generated;
+	{
+		std::lock_guard<std::mutex> lock(mu);	// Thread safe
+		std::swap(generated, renderQ);
+		if (farFieldFilled && !farFieldReady) {
+			farFieldReady = true;
+			farFieldHeights += farFieldFillHeights;
+		}
+		jobCamPos = camPos;
+		computeStepRanges(jobStepRanges);
+	}
+	while (!generated.empty())
+	{
+		Chunk* newChunk = generated.front();
+		generated.pop();
+		generating.erase(newChunk->coord);
+		refining.erase(newChunk->coord);
+		if (!withinRadius(newChunk->coord, residencyRadius)) {
+			newChunk->recycle();
+			chunkPool.release(newChunk);
+			continue;
+		}
+		// A refined chunk replaces the coarser one, a chunk that is not finer than the kept one arrived late
+		auto kept = chunks.find(newChunk->coord);
+		if (kept != chunks.end()) {
+			if (kept->second->getStep() <= newChunk->getStep()) {
+				newChunk->recycle();
+				chunkPool.release(newChunk);
+				continue;
+			}
+			deleteChunk(kept->second);
 		}
 
-		//bounding box intersect, not nessesary for us?
-		//if (intersects)
-		//	return;
+		if (cdlodCreated)
+			newChunk->uploadHeights(cdlod);
+		if (!cdlodMode)
+			newChunk->bakeMeshes(lodIndices, flatMesh, flatAdaptiveIndices, adaptiveMeshing);
+		addChunk(newChunk);
+		requestAdaptiveIndices(newChunk);
+		releaseGeometry(newChunk);
+	}
+	updateAdaptiveIndices();
 
-		//bounding box is inside -> draw object
-		chunk->drawChunk = !outside;
+	if (filling && generating.empty()) {
+		fillTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - fillStart).count();
+		filling = false;
 	}
+	requestRefinements(camPos);
+
+	if (farFieldMode && farFieldReady)
+		farFieldHeights += farField.update(camPos);
 }
 
-std::pair<float, float> ChunkHandler::newChunkPosition(chunkChecker cc, unsigned int gridId) const
+void ChunkHandler::cullTerrainChunk(const std::vector<CameraPlane>& cameraPlanes)
 {
-	glm::vec3 prevPos = chunks[gridId]->getPostition();
-	std::pair<float, float> newPos;
-
-	switch (cc) {
-	case chunkChecker::up:
-		newPos.first = prevPos.x;
-		newPos.second = prevPos.z - (nrVertices - 1) * spacing;
-		break;
-	case chunkChecker::down:
-		newPos.first = prevPos.x;
-		newPos.second = prevPos.z + (nrVertices - 1) * spacing;
-		break;
-	case chunkChecker::left:
-		newPos.first = prevPos.x - (nrVertices - 1) * spacing;
-		newPos.second = prevPos.z;
-		break;
-	case chunkChecker::right:
-		newPos.first = prevPos.x + (nrVertices - 1) * spacing;
-		newPos.second = prevPos.z;
-		break;
-	default:
-		break;
-	}
+	culler.setPlanes(cameraPlanes);
+}
 
-	return newPos;
+AABB ChunkHandler::estimateBounds(const std::pair<float, float>& pos, const std::pair<float, float>& heights) const
+{
+	float width = (nrVertices - 1) * spacing;
+	auto [minHeight, maxHeight] = heights;
+	return AABB{ { pos.first, minHeight, pos.second }, { pos.first + width, maxHeight, pos.second + width } };
 }
@@ -0,0 +1,210 @@
+#include "..\header\ChunkIndexBuffer.h"
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+
+ChunkIndexBuffer::ChunkIndexBuffer(unsigned int _nrVertices, unsigned int _maxLod, unsigned int _patchesPerSide)
+	: nrVertices{ _nrVertices + 2 }, maxLod{ _maxLod }, patchesPerSide{ _patchesPerSide }
+{
+	for (unsigned int lod = 1; lod <= maxLod; lod *= 2) {
+		addLod(lod);
+	}
+}
+
+void ChunkIndexBuffer::bake()
+{
+	glGenBuffers(1, &EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	baked = true;
+}
+
+void ChunkIndexBuffer::deleteBuffer()
+{
+	if (baked) {
+		glDeleteBuffers(1, &EBO);
+		baked = false;
+	}
+}
+
+unsigned int ChunkIndexBuffer::lodLevel(unsigned int lod)
+{
+	unsigned int level = 0;
+	while (lod > 1) {
+		lod /= 2;
+		++level;
+	}
+	return level;
+}
+
+unsigned int ChunkIndexBuffer::gridCoordinate(unsigned int i, unsigned int lod, unsigned int lodSize) const
+{
+	if (i == 0) //first skirt
+		return 0;
+	if (i == lodSize - 1) //last skirt
+		return nrVertices - 1;
+	return (i - 1) * lod + 1;
+}
+
+unsigned int ChunkIndexBuffer::edgeIndex(Side side, unsigned int t, unsigned int s) const
+{
+	unsigned int x, z;
+	switch (side)
+	{
+	case north:
+		x = 1 + t;
+		z = 1 + s;
+		break;
+	case south:
+		x = 1 + t;
+		z = nrVertices - 2 - s;
+		break;
+	case west:
+		x = 1 + s;
+		z = 1 + t;
+		break;
+	case east:
+	default:
+		x = nrVertices - 2 - s;
+		z = 1 + t;
+		break;
+	}
+	return x + nrVertices * z;
+}
+
+void ChunkIndexBuffer::addTriangle(unsigned int a, unsigned int b, unsigned int c)
+{
+	//Same winding as the grid cells, (b - a) x (c - a) must point up
+	int ax = a % nrVertices, az = a / nrVertices;
+	int bx = b % nrVertices, bz = b / nrVertices;
+	int cx = c % nrVertices, cz = c / nrVertices;
+	if ((bz - az) * (cx - ax) - (bx - ax) * (cz - az) < 0)
+		std::swap(b, c);
+
+	indices.push_back(a);
+	indices.push_back(b);
+	indices.push_back(c);
+}
+
+void ChunkIndexBuffer::addCell(unsigned int x1, unsigned int z1, unsigned int x2, unsigned int z2)
+{
+	unsigned int i1, i2, i3, i4;
+	i1 = x1 + nrVertices * z1; //current
+	i2 = x1 + nrVertices * z2; //bottom
+	i3 = x2 + nrVertices * z2; //bottom right
+	i4 = x2 + nrVertices * z1; // right 
+
+	/*
+		i1--<--i4
+		 |\    |
+		 v \   ^
+		 |  \  |
+		 |   \ |
+		i2-->--i3
+	*/
+
+	//left triangle diagonal from top left to bottom right 
+	indices.push_back(i1);
+	indices.push_back(i2);
+	indices.push_back(i3);
+	//right triangle
+	indices.push_back(i1);
+	indices.push_back(i3);
+	indices.push_back(i4);
+}
+
+void ChunkIndexBuffer::addLod(unsigned int lod)
+{
+	unsigned int size = (nrVertices - 3) / lod + 3; //vertices per side in this lod including skirts
+	LodSet set;
+	set.skirted = Range{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+	indices.reserve(indices.size() + 6 * (size - 1) * (size - 1));
+
+	for (unsigned int depth = 0; depth < size - 1; ++depth) {
+		for (unsigned int width = 0; width < size - 1; ++width) {
+			addCell(gridCoordinate(width, lod, size), gridCoordinate(depth, lod, size), 
+				gridCoordinate(width + 1, lod, size), gridCoordinate(depth + 1, lod, size));
+		}
+	}
+	set.skirted.count = static_cast<unsigned int>(indices.size()) - set.skirted.offset / sizeof(unsigned int);
+	set.skirtTriangles = set.skirted.count / 3 - 2 * (size - 3) * (size - 3);
+
+	set.core = addCore(lod, set.patches);
+	set.border = addBorder(lod);
+	for (unsigned int side = north; side <= east; ++side) {
+		set.edges[side].resize(lodLevel(maxLod) + 1, Range{ 0, 0 });
+		for (unsigned int edgeLod = lod; edgeLod <= maxLod; edgeLod *= 2) {
+			set.edges[side][lodLevel(edgeLod)] = addEdge(lod, static_cast<Side>(side), edgeLod);
+		}
+	}
+	lods.push_back(set);
+}
+
+ChunkIndexBuffer::Range ChunkIndexBuffer::addCore(unsigned int lod, std::vector<Range>& patches)
+{
+	unsigned int span = nrVertices - 3; //chunk width in full resolution steps
+	unsigned int patchSpan = span / patchesPerSide;
+	Range range{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+
+	//The core is every cell except the outermost ring, ie. cells starting at lod up to span - 2 * lod
+	for (unsigned int pz = 0; pz < patchesPerSide; ++pz) {
+		for (unsigned int px = 0; px < patchesPerSide; ++px) {
+			Range patch{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+			for (unsigned int z = std::max(lod, pz * patchSpan); z < (pz + 1) * patchSpan && z + 2 * lod <= span; z += lod) {
+				for (unsigned int x = std::max(lod, px * patchSpan); x < (px + 1) * patchSpan && x + 2 * lod <= span; x += lod) {
+					addCell(1 + x, 1 + z, 1 + x + lod, 1 + z + lod);
+				}
+			}
+			patch.count = static_cast<unsigned int>(indices.size()) - patch.offset / sizeof(unsigned int);
+			patches.push_back(patch);
+		}
+	}
+	range.count = static_cast<unsigned int>(indices.size()) - range.offset / sizeof(unsigned int);
+	return range;
+}
+
+ChunkIndexBuffer::Range ChunkIndexBuffer::addBorder(unsigned int lod)
+{
+	unsigned int size = (nrVertices - 3) / lod + 3; //vertices per side in this lod including skirts
+	Range range{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+
+	for (unsigned int depth = 0; depth < size - 1; ++depth) {
+		for (unsigned int width = 0; width < size - 1; ++width) {
+			if (depth <= 1 || width <= 1 || depth >= size - 3 || width >= size - 3) {
+				addCell(gridCoordinate(width, lod, size), gridCoordinate(depth, lod, size),
+					gridCoordinate(width + 1, lod, size), gridCoordinate(depth + 1, lod, size));
+			}
+		}
+	}
+	range.count = static_cast<unsigned int>(indices.size()) - range.offset / sizeof(unsigned int);
+	return range;
+}
+
+ChunkIndexBuffer::Range ChunkIndexBuffer::addEdge(unsigned int lod, Side side, unsigned int edgeLod)
+{
+	unsigned int span = nrVertices - 3; //chunk width in full resolution steps
+	Range range{ static_cast<unsigned int>(indices.size() * sizeof(unsigned int)), 0 };
+
+	//The strip is a trapezoid, the outer row spans the whole side and the inner row stops one cell from each corner
+	std::vector<unsigned int> outer, inner;
+	for (unsigned int t = 0; t <= span; t += edgeLod)
+		outer.push_back(t);
+	for (unsigned int t = lod; t + lod <= span; t += lod)
+		inner.push_back(t);
+
+	//Zip the two rows together, always advancing the row whose next segment is centered furthest back
+	size_t i = 0, j = 0;
+	while (i + 1 < outer.size() || j + 1 < inner.size()) {
+		if (j + 1 == inner.size() || (i + 1 < outer.size() && outer[i] + outer[i + 1] <= inner[j] + inner[j + 1])) {
+			addTriangle(edgeIndex(side, outer[i], 0), edgeIndex(side, outer[i + 1], 0), edgeIndex(side, inner[j], lod));
+			++i;
+		}
+		else {
+			addTriangle(edgeIndex(side, outer[i], 0), edgeIndex(side, inner[j + 1], lod), edgeIndex(side, inner[j], lod));
+			++j;
+		}
+	}
+	range.count = static_cast<unsigned int>(indices.size()) - range.offset / sizeof(unsigned int);
+	return range;
+}
@@ -0,0 +1,337 @@
+#include "..\header\GeometryClipmap.h"
+#include "..\header\TerrainNoise.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+GeometryClipmap::GeometryClipmap(unsigned int _cells, float _spacing, const glm::vec2& _anchor, float _skirtDepth)
+	: cells{ _cells }, spacing{ _spacing }, anchor{ _anchor }, skirtDepth{ _skirtDepth }
+{
+	//Every level draws the same window, vertices only hold their grid coordinate in it. The second copy is the skirt around the hole
+	unsigned int size = cells + 1;
+	std::vector<TerrainVertex> window;
+	window.reserve(2 * size * size);
+	for (uint8_t flags : { uint8_t{ 0 }, TerrainVertex::skirtFlag }) {
+		for (unsigned int z = 0; z < size; ++z) {
+			for (unsigned int x = 0; x < size; ++x) {
+				TerrainVertex v;
+				v.gridX = static_cast<uint8_t>(x);
+				v.gridZ = static_cast<uint8_t>(z);
+				v.flags = flags;
+				window.push_back(v);
+			}
+		}
+	}
+	//Cells row by row, so any run of cells in a row is one range
+	std::vector<unsigned int> indices;
+	indices.reserve(cells * cells * 6);
+	for (unsigned int z = 0; z < cells; ++z) {
+		for (unsigned int x = 0; x < cells; ++x)
+			addCell(indices, x + size * z, x + size * (z + 1), (x + 1) + size * (z + 1), (x + 1) + size * z);
+	}
+	gridIndices = static_cast<unsigned int>(indices.size());
+
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &EBO);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, window.size() * sizeof(TerrainVertex), &window[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribIPointer(0, 3, GL_UNSIGNED_BYTE, sizeof(TerrainVertex), (void*)0);
+	//Room for a skirt along the whole window, 4 sides of cells quads
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (gridIndices + 24 * cells) * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, gridIndices * sizeof(unsigned int), &indices[0]);
+	glBindVertexArray(0);
+
+	glGenTextures(1, &heightTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, size, size, levels, 0, GL_RED, GL_FLOAT, nullptr);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	for (Level& level : levelData)
+		level.heights.assign(size * size, 0.0f);
+}
+
+void GeometryClipmap::deleteBuffers()
+{
+	if (VAO != 0) {
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteTextures(1, &heightTexture);
+		VAO = 0;
+	}
+}
+
+glm::ivec2 GeometryClipmap::levelOrigin(unsigned int level, const glm::vec3& camPos) const
+{
+	float step = spacing * (1u << level);
+	float x = (camPos.x - anchor.x) / step - cells / 2.0f;
+	float z = (camPos.z - anchor.y) / step - cells / 2.0f;
+	return glm::ivec2{ 2 * static_cast<int>(std::floor(x / 2.0f)), 2 * static_cast<int>(std::floor(z / 2.0f)) };
+}
+
+unsigned int GeometryClipmap::update(const glm::vec3& camPos)
+{
+	int size = static_cast<int>(cells) + 1;
+	unsigned int computed = 0;
+	for (unsigned int level = 0; level < levels; ++level) {
+		Level& data = levelData[level];
+		if (data.filled) {
+			uploadHeights(level, data.origin.x, data.origin.y, data.origin.x + size, data.origin.y + size);
+			data.filled = false;
+			data.valid = true;
+		}
+		glm::ivec2 origin = levelOrigin(level, camPos);
+		glm::ivec2 old = data.origin;
+		if (!data.valid || std::abs(origin.x - old.x) >= size || std::abs(origin.y - old.y) >= size) {
+			data.minHeight = std::numeric_limits<float>::max();
+			data.maxHeight = std::numeric_limits<float>::lowest();
+			computed += refresh(level, origin.x, origin.y, origin.x + size, origin.y + size);
+		}
+		else {
+			//Columns that scrolled in over the whole new window, then rows that scrolled in beside them
+			if (origin.x > old.x)
+				computed += refresh(level, old.x + size, origin.y, origin.x + size, origin.y + size);
+			else if (origin.x < old.x)
+				computed += refresh(level, origin.x, origin.y, old.x, origin.y + size);
+			int x0 = std::max(origin.x, old.x), x1 = std::min(origin.x, old.x) + size;
+			if (origin.y > old.y)
+				computed += refresh(level, x0, old.y + size, x1, origin.y + size);
+			else if (origin.y < old.y)
+				computed += refresh(level, x0, origin.y, x1, old.y);
+		}
+		data.origin = origin;
+		data.valid = true;
+	}
+	return computed;
+}
+
+unsigned int GeometryClipmap::fill(const glm::vec3& camPos)
+{
+	int size = static_cast<int>(cells) + 1;
+	for (unsigned int level = 0; level < levels; ++level) {
+		Level& data = levelData[level];
+		data.origin = levelOrigin(level, camPos);
+		data.minHeight = std::numeric_limits<float>::max();
+		data.maxHeight = std::numeric_limits<float>::lowest();
+		computeHeights(level, data.origin.x, data.origin.y, data.origin.x + size, data.origin.y + size);
+		data.valid = false;
+		data.filled = true;
+	}
+	return levels * static_cast<unsigned int>(size * size);
+}
+
+unsigned int GeometryClipmap::refresh(unsigned int level, int x0, int z0, int x1, int z1)
+{
+	if (x1 <= x0 || z1 <= z0)
+		return 0;
+
+	computeHeights(level, x0, z0, x1, z1);
+	uploadHeights(level, x0, z0, x1, z1);
+	return static_cast<unsigned int>((x1 - x0) * (z1 - z0));
+}
+
+void GeometryClipmap::computeHeights(unsigned int level, int x0, int z0, int x1, int z1)
+{
+	Level& data = levelData[level];
+	int size = static_cast<int>(cells) + 1;
+	int step = 1 << level;
+	for (int z = z0; z < z1; ++z) {
+		for (int x = x0; x < x1; ++x) {
+			//Positions from integer lattice coordinates, so points shared by two levels get the exact same height
+			float h = TerrainNoise::height(anchor.x + static_cast<float>(x * step) * spacing, anchor.y + static_cast<float>(z * step) * spacing);
+			data.heights[wrap(x) + size * wrap(z)] = h;
+			data.minHeight = std::min(data.minHeight, h);
+			data.maxHeight = std::max(data.maxHeight, h);
+		}
+	}
+}
+
+void GeometryClipmap::uploadHeights(unsigned int level, int x0, int z0, int x1, int z1)
+{
+	const Level& data = levelData[level];
+	int size = static_cast<int>(cells) + 1;
+
+	//A range of lattice coordinates wraps around the texture at most once
+	auto texelRanges = [&](int k0, int k1, int ranges[2][2]) {
+		int first = wrap(k0);
+		int count = std::min(k1 - k0, size - first);
+		ranges[0][0] = first;
+		ranges[0][1] = count;
+		ranges[1][0] = 0;
+		ranges[1][1] = (k1 - k0) - count;
+	};
+	int xRanges[2][2], zRanges[2][2];
+	texelRanges(x0, x1, xRanges);
+	texelRanges(z0, z1, zRanges);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+	for (auto& xr : xRanges) {
+		for (auto& zr : zRanges) {
+			if (xr[1] == 0 || zr[1] == 0)
+				continue;
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, xr[0]);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, zr[0]);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, xr[0], zr[0], level, xr[1], zr[1], 1, GL_RED, GL_FLOAT, &data.heights[0]);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void GeometryClipmap::addHole(const glm::vec2& min, const glm::vec2& max)
+{
+	holes.push_back({ glm::ivec2{ glm::round((min - anchor) / spacing) }, glm::ivec2{ glm::round((max - anchor) / spacing) } });
+}
+
+unsigned int GeometryClipmap::draw(const Shader& shader, const ChunkCuller& culler)
+{
+	drawCalls = 0;
+	if (!levelData[0].valid)
+		return 0;
+
+	shader.setBool("clipmap", true);
+	shader.setInt("clipmapHeights", heightUnit);
+	shader.setVec2("clipmapAnchor", anchor);
+	shader.setFloat("clipmapSpacing", spacing);
+	shader.setInt("clipmapCells", static_cast<int>(cells));
+	shader.setFloat("skirtDepth", skirtDepth);
+	shader.setVec3("lodColor", glm::vec3{ 0.7f, 0.7f, 0.7f });
+
+	glActiveTexture(GL_TEXTURE0 + heightUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+	glBindVertexArray(VAO);
+
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+	//Runs of cells that directly follow the previous run are merged into it
+	auto addRange = [&](unsigned int first, unsigned int count) {
+		if (!counts.empty() && (size_t)offsets.back() + counts.back() * sizeof(unsigned int) == first * sizeof(unsigned int))
+			counts.back() += count;
+		else {
+			counts.push_back(count);
+			offsets.push_back((void*)(first * sizeof(unsigned int)));
+		}
+	};
+
+	unsigned int triangles = 0;
+	int n = static_cast<int>(cells);
+	for (unsigned int level = 0; level < levels; ++level) {
+		const Level& data = levelData[level];
+		//Hole in cells of this level, the chunks for the finest level and the next finer level for the others
+		holeRuns.assign(n, glm::ivec2{ n, n });
+		if (level == 0) {
+			for (int z = 0; z < n; ++z) {
+				int row = data.origin.y + z;
+				glm::ivec2 run{ n, 0 };
+				for (const auto& [min, max] : holes) {
+					if (row >= min.y && row < max.y) {
+						run.x = std::min(run.x, min.x - data.origin.x);
+						run.y = std::max(run.y, max.x - data.origin.x);
+					}
+				}
+				run = glm::clamp(run, 0, n);
+				if (run.x < run.y)
+					holeRuns[z] = run;
+			}
+			if (holeRuns != skirtRuns)
+				buildSkirt(holeRuns);
+		}
+		else {
+			glm::ivec2 min = levelData[level - 1].origin / 2 - data.origin;
+			for (int z = min.y; z < min.y + n / 2; ++z)
+				holeRuns[z] = glm::ivec2{ min.x, min.x + n / 2 };
+		}
+
+		float step = spacing * (1u << level);
+		auto cellCorner = [&](int x, int z) {
+			return anchor + glm::vec2{ data.origin + glm::ivec2{ x, z } } * step;
+		};
+		counts.clear();
+		offsets.clear();
+		for (int z = 0; z < n; ++z) {
+			const glm::ivec2& hole = holeRuns[z];
+			for (int x0 = 0; x0 < n; x0 += blockCells) {
+				int x1 = std::min(x0 + static_cast<int>(blockCells), n);
+				int runs[2][2] = { { x0, std::min(x1, hole.x) }, { std::max(x0, hole.y), x1 } };
+				for (auto& run : runs) {
+					if (run[1] <= run[0])
+						continue;
+					glm::vec2 a = cellCorner(run[0], z), b = cellCorner(run[1], z + 1);
+					if (culler.inFrustum(AABB{ { a.x, data.minHeight, a.y }, { b.x, data.maxHeight, b.y } }))
+						addRange(6 * (run[0] + n * z), 6 * (run[1] - run[0]));
+				}
+			}
+		}
+		if (level == 0 && skirtIndices > 0)
+			addRange(gridIndices, skirtIndices);
+		if (counts.empty())
+			continue;
+
+		shader.setInt("clipmapLevel", static_cast<int>(level));
+		shader.setIVec2("clipmapOrigin", data.origin);
+		shader.setIVec2("clipmapTexel", glm::ivec2{ wrap(data.origin.x), wrap(data.origin.y) });
+		glMultiDrawElements(GL_TRIANGLES, &counts[0], GL_UNSIGNED_INT, &offsets[0], static_cast<GLsizei>(counts.size()));
+		++drawCalls;
+		for (GLsizei count : counts)
+			triangles += count / 3;
+	}
+
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glActiveTexture(GL_TEXTURE0);
+	shader.setBool("clipmap", false);
+	return triangles;
+}
+
+void GeometryClipmap::buildSkirt(const std::vector<glm::ivec2>& runs)
+{
+	skirtRuns = runs;
+	std::vector<unsigned int> skirt;
+	int n = static_cast<int>(cells);
+	unsigned int size = cells + 1, twin = size * size;
+	auto vertex = [&](int x, int z) { return static_cast<unsigned int>(x) + size * static_cast<unsigned int>(z); };
+	auto inHole = [&](int x, int z) { return z >= 0 && z < n && x >= runs[z].x && x < runs[z].y; };
+	//Walls hang from the sides of the hole and face into it, towards the camera over the chunks
+	for (int z = 0; z < n; ++z) {
+		if (runs[z].x >= runs[z].y)
+			continue;
+		int x0 = runs[z].x, x1 = runs[z].y;
+		addCell(skirt, vertex(x0, z), vertex(x0, z + 1), vertex(x0, z + 1) + twin, vertex(x0, z) + twin);
+		addCell(skirt, vertex(x1, z) + twin, vertex(x1, z + 1) + twin, vertex(x1, z + 1), vertex(x1, z));
+	}
+	//Between two rows wherever only one of them is in the hole
+	for (int z = 0; z <= n; ++z) {
+		for (int x = 0; x < n; ++x) {
+			bool above = inHole(x, z - 1), below = inHole(x, z);
+			if (below && !above)
+				addCell(skirt, vertex(x, z), vertex(x, z) + twin, vertex(x + 1, z) + twin, vertex(x + 1, z));
+			else if (above && !below)
+				addCell(skirt, vertex(x, z) + twin, vertex(x, z), vertex(x + 1, z), vertex(x + 1, z) + twin);
+		}
+	}
+	skirtIndices = static_cast<unsigned int>(skirt.size());
+	if (skirt.empty())
+		return;
+	//Called from draw, which keeps the VAO bound for the levels still to come
+	glBindVertexArray(VAO);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, gridIndices * sizeof(unsigned int), skirt.size() * sizeof(unsigned int), &skirt[0]);
+}
+
+void GeometryClipmap::addCell(std::vector<unsigned int>& target, unsigned int i1, unsigned int i2, unsigned int i3, unsigned int i4) const
+{
+	//diagonal from i1 to i3, ie. top left to bottom right as in ChunkIndexBuffer
+	target.push_back(i1);
+	target.push_back(i2);
+	target.push_back(i3);
+	target.push_back(i1);
+	target.push_back(i3);
+	target.push_back(i4);
+}
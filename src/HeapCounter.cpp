@@ -0,0 +1,39 @@
+#include "..\header\HeapCounter.h"
+#include <new>
+#include <cstdlib>
+
+namespace {
+	//Zero initialized, so it is safe to touch from operator new before anything else on the thread has run
+	thread_local size_t allocations = 0;
+}
+
+size_t HeapCounter::local()
+{
+	return allocations;
+}
+
+void HeapCounter::charge(size_t count)
+{
+	allocations += count;
+}
+
+#if COUNT_HEAP_ALLOCATIONS
+//The array and nothrow forms call these, aligned allocations are not counted
+void* operator new(std::size_t size)
+{
+	++allocations;
+	if (void* memory = std::malloc(size > 0 ? size : 1))
+		return memory;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+#endif
@@ -0,0 +1,52 @@
+#include "..\header\LodGovernor.h"
+#include <algorithm>
+#include <cmath>
+
+LodGovernor::LodGovernor(float _targetFrameTime, unsigned int _maxRings)
+	: targetFrameTime{ _targetFrameTime }, maxRings{ _maxRings }
+{
+	reset();
+}
+
+void LodGovernor::update(float frameTime)
+{
+	smoothedFrameTime += smoothing * (frameTime - smoothedFrameTime);
+	timeSinceAdjust += frameTime;
+	if (timeSinceAdjust < adjustInterval)
+		return;
+
+	float error = smoothedFrameTime / targetFrameTime - 1.0f;
+	if (std::abs(error) < deadband)
+		return;
+	timeSinceAdjust = 0.0f;
+
+	if (error > 0.0f) {
+		// Too slow, coarsen lods first and draw fewer rings once lods are as coarse as allowed
+		if (lodScale < maxLodScale)
+			lodScale = std::min(maxLodScale, lodScale * (1.0f + std::min(error, maxStep)));
+		else if (drawRings > minRings)
+			--drawRings;
+	}
+	else {
+		// Headroom, recover at half the rate, rings first since they are lost last
+		if (drawRings < maxRings)
+			++drawRings;
+		else
+			lodScale = std::max(minLodScale, lodScale * (1.0f + std::max(error, -maxStep) / 2.0f));
+	}
+}
+
+void LodGovernor::reset()
+{
+	smoothedFrameTime = targetFrameTime;
+	lodScale = 1.0f;
+	drawRings = maxRings;
+	timeSinceAdjust = 0.0f;
+}
+
+void LodGovernor::fillStats(FrameStats& stats) const
+{
+	stats.smoothedFrameTime = smoothedFrameTime;
+	stats.lodScale = lodScale;
+	stats.drawRings = drawRings;
+}
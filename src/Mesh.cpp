@@ -1,43 +1,121 @@
 #include "../header/Mesh.h"
+#include <utility>
 
-Mesh::Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+template<typename V>
+BasicMesh<V>::BasicMesh(std::vector<V> vertices, std::vector<unsigned int> indices)
 {
-    this->vertices = vertices;
-    this->indices = indices;
+    this->vertices = std::move(vertices);
+    this->indices = std::move(indices);
 
     setupMesh();
 }
 
-void Mesh::deleteMesh()
+template<typename V>
+BasicMesh<V>::BasicMesh(std::vector<V> vertices, unsigned int sharedEBO)
+{
+    this->vertices = std::move(vertices);
+    EBO = sharedEBO;
+    ownsEBO = false;
+
+    setupMesh();
+}
+
+template<typename V>
+void BasicMesh<V>::deleteMesh()
 {
     if (bakedMesh) {
-        glDeleteBuffers(1, &EBO);
+        if (ownsEBO)
+            glDeleteBuffers(1, &EBO);
         glDeleteBuffers(1, &VBO);
         glDeleteVertexArrays(1, &VAO);
+        bakedMesh = false;
     }
 }
 
-void Mesh::draw(int polygonMode)
+template<typename V>
+std::vector<V> BasicMesh<V>::releaseGeometry()
+{
+    std::vector<V> released;
+    released.swap(vertices);
+    std::vector<unsigned int>().swap(indices);
+    return released;
+}
+
+template<typename V>
+void BasicMesh<V>::readVertices(V* out) const
+{
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, nrVertices * sizeof(V), out);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+template<typename V>
+void BasicMesh<V>::setElementBuffer(unsigned int sharedEBO)
+{
+    EBO = sharedEBO;
+    //The element buffer binding is part of the VAO state
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBindVertexArray(0);
+}
+
+template<typename V>
+void BasicMesh<V>::draw(int polygonMode)
+{
+    glBindVertexArray(VAO);
+    glDrawElements(polygonMode, nrIndices, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+}
+
+template<typename V>
+void BasicMesh<V>::draw(int polygonMode, unsigned int count, unsigned int offset)
 {
     glBindVertexArray(VAO);
-    glDrawElements(polygonMode, indices.size(), GL_UNSIGNED_INT, 0);
+    glDrawElements(polygonMode, count, GL_UNSIGNED_INT, (void*)(size_t)offset);
     glBindVertexArray(0);
 }
 
-void Mesh::setupMesh()
+template<typename V>
+void BasicMesh<V>::draw(int polygonMode, const GLsizei* counts, const unsigned int* offsets, int nrRanges)
+{
+    const void* byteOffsets[32];
+    for (int i = 0; i < nrRanges; ++i)
+        byteOffsets[i] = (void*)(size_t)offsets[i];
+
+    glBindVertexArray(VAO);
+    glMultiDrawElements(polygonMode, counts, GL_UNSIGNED_INT, byteOffsets, nrRanges);
+    glBindVertexArray(0);
+}
+
+template<typename V>
+void BasicMesh<V>::setupMesh()
 {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+    if (ownsEBO)
+        glGenBuffers(1, &EBO);
 
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+    nrVertices = static_cast<unsigned int>(vertices.size());
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(V), &vertices[0], GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+    if (ownsEBO) {
+        nrIndices = static_cast<unsigned int>(indices.size());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+    }
+
+    setupVertexAttributes();
+
+    bakedMesh = true;
+    glBindVertexArray(0);
+}
 
+template<>
+void BasicMesh<Vertex>::setupVertexAttributes()
+{
     // vertex positions
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -47,7 +125,21 @@ void Mesh::setupMesh()
     // Color
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+}
 
-    bakedMesh = true;
-    glBindVertexArray(0);
+template<>
+void BasicMesh<TerrainVertex>::setupVertexAttributes()
+{
+    // grid x, grid z and flags as integers
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 3, GL_UNSIGNED_BYTE, sizeof(TerrainVertex), (void*)0);
+    // quantized height, normalized to [0, 1] between chunk min and max height
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, height));
+    // octahedral normal, normalized to [-1, 1]
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_BYTE, GL_TRUE, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, normal));
 }
+
+template class BasicMesh<Vertex>;
+template class BasicMesh<TerrainVertex>;
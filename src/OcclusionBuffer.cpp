@@ -0,0 +1,95 @@
+#include "..\header\OcclusionBuffer.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+OcclusionBuffer::OcclusionBuffer(unsigned int _width, unsigned int _height)
+	: width{ _width }, height{ _height }, depth(_width * _height, std::numeric_limits<float>::max())
+{
+}
+
+void OcclusionBuffer::clear(const glm::mat4& _viewProjection)
+{
+	viewProjection = _viewProjection;
+	std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::max());
+}
+
+bool OcclusionBuffer::project(const glm::vec3& p, ScreenPoint& out) const
+{
+	glm::vec4 clip = viewProjection * glm::vec4{ p, 1.0f };
+	if (clip.w <= nearW)
+		return false;
+	out.x = (clip.x / clip.w * 0.5f + 0.5f) * width;
+	out.y = (clip.y / clip.w * 0.5f + 0.5f) * height;
+	out.w = clip.w;
+	return true;
+}
+
+void OcclusionBuffer::addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	ScreenPoint p[3];
+	if (!project(a, p[0]) || !project(b, p[1]) || !project(c, p[2]))
+		return;
+
+	float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+	if (area == 0.0f)
+		return;
+	if (area < 0.0f)
+		std::swap(p[1], p[2]);
+
+	int x0 = std::max(0, static_cast<int>(std::floor(std::min({ p[0].x, p[1].x, p[2].x }))));
+	int x1 = std::min(static_cast<int>(width) - 1, static_cast<int>(std::ceil(std::max({ p[0].x, p[1].x, p[2].x }))) - 1);
+	int y0 = std::max(0, static_cast<int>(std::floor(std::min({ p[0].y, p[1].y, p[2].y }))));
+	int y1 = std::min(static_cast<int>(height) - 1, static_cast<int>(std::ceil(std::max({ p[0].y, p[1].y, p[2].y }))) - 1);
+	float w = std::max({ p[0].w, p[1].w, p[2].w });
+
+	// Edge functions e(x, y) = A * x + B * y + C, positive inside. A pixel is covered when its worst corner is inside every edge
+	float A[3], B[3], C[3];
+	for (int i = 0; i < 3; ++i) {
+		const ScreenPoint& s = p[i];
+		const ScreenPoint& e = p[(i + 1) % 3];
+		A[i] = s.y - e.y;
+		B[i] = e.x - s.x;
+		C[i] = s.x * e.y - s.y * e.x + std::min(A[i], 0.0f) + std::min(B[i], 0.0f);
+	}
+
+	for (int y = y0; y <= y1; ++y) {
+		for (int x = x0; x <= x1; ++x) {
+			if (A[0] * x + B[0] * y + C[0] >= 0.0f && A[1] * x + B[1] * y + C[1] >= 0.0f && A[2] * x + B[2] * y + C[2] >= 0.0f) {
+				float& d = depth[x + width * y];
+				d = std::min(d, w);
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::isOccluded(const glm::vec3& min, const glm::vec3& max) const
+{
+	float minX = std::numeric_limits<float>::max(), minY = minX, minW = minX;
+	float maxX = std::numeric_limits<float>::lowest(), maxY = maxX;
+	for (int i = 0; i < 8; ++i) {
+		ScreenPoint s;
+		if (!project({ i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z }, s))
+			return false;
+		minX = std::min(minX, s.x);
+		maxX = std::max(maxX, s.x);
+		minY = std::min(minY, s.y);
+		maxY = std::max(maxY, s.y);
+		minW = std::min(minW, s.w);
+	}
+
+	int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+	int x1 = std::min(static_cast<int>(width) - 1, static_cast<int>(std::ceil(maxX)) - 1);
+	int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+	int y1 = std::min(static_cast<int>(height) - 1, static_cast<int>(std::ceil(maxY)) - 1);
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	for (int y = y0; y <= y1; ++y) {
+		for (int x = x0; x <= x1; ++x) {
+			if (depth[x + width * y] >= minW)
+				return false;
+		}
+	}
+	return true;
+}
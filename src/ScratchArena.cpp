@@ -0,0 +1,39 @@
+#include "..\header\ScratchArena.h"
+#include <algorithm>
+
+ScratchArena::~ScratchArena()
+{
+	for (Block& block : blocks)
+		delete[] block.data;
+}
+
+ScratchArena& ScratchArena::local()
+{
+	thread_local ScratchArena arena;
+	return arena;
+}
+
+void* ScratchArena::allocate(size_t size, size_t alignment)
+{
+	++counters.allocations;
+	counters.bytes += size;
+
+	//Blocks too small for the allocation are skipped until the scope closes, a block that fits is added after the last one
+	while (current < blocks.size()) {
+		size_t start = (offset + alignment - 1) / alignment * alignment;
+		if (start + size <= blocks[current].size) {
+			offset = start + size;
+			return blocks[current].data + start;
+		}
+		++current;
+		offset = 0;
+	}
+
+	//new[] memory is aligned for any standard type
+	++counters.heapAllocations;
+	Block block{ new char[std::max(size, minBlockSize)], std::max(size, minBlockSize) };
+	blocks.push_back(block);
+	current = blocks.size() - 1;
+	offset = size;
+	return block.data;
+}
@@ -0,0 +1,190 @@
+#include "..\header\TerrainNoise.h"
+#include <glm/gtc/noise.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <limits>
+
+float TerrainNoise::height(float x, float z)
+{
+	/*** Apply noise to the height ie. y component using fbm ***/
+	float noiseSum = 0.0f;
+	float amp = amplitude;
+	float freq = frequency;
+
+	//Add noise from all octaves
+	for (int i = 0; i < octaves; ++i) {
+		noiseSum += amp * glm::perlin(glm::vec3((x + 1) * freq, (z + 1) * freq, seed));
+		freq *= lacunarity;
+		amp *= gain;
+	}
+
+	return noiseSum < groundLevel ? groundLevel : noiseSum;
+}
+
+std::pair<float, float> TerrainNoise::estimateHeightRange(float x0, float z0, float x1, float z1)
+{
+	//Gradients of the octaves that are bounded per lattice cell, shared by all tiles
+	std::vector<Lattice> lattices(octaves);
+	float freq = frequency;
+	for (int i = 0; i < octaves; ++i) {
+		//Same noise space coordinates as height
+		float nx0 = (x0 + 1) * freq, nx1 = (x1 + 1) * freq;
+		float nz0 = (z0 + 1) * freq, nz1 = (z1 + 1) * freq;
+		if (std::floor(nx1) - std::floor(nx0) < maxLatticeCells && std::floor(nz1) - std::floor(nz0) < maxLatticeCells)
+			lattices[i] = makeLattice(nx0, nz0, nx1, nz1);
+		freq *= lacunarity;
+	}
+
+	//Octave bounds are summed, which ignores that the octaves peak in different places. Bounding smaller tiles separately keeps that loss small
+	float minHeight = std::numeric_limits<float>::max(), maxHeight = std::numeric_limits<float>::lowest();
+	for (int tz = 0; tz < tiles; ++tz) {
+		for (int tx = 0; tx < tiles; ++tx) {
+			//The last edges are taken as they are, rounding must not move them past the region the lattices cover
+			float tileX0 = x0 + (x1 - x0) * tx / tiles, tileX1 = tx + 1 == tiles ? x1 : x0 + (x1 - x0) * (tx + 1) / tiles;
+			float tileZ0 = z0 + (z1 - z0) * tz / tiles, tileZ1 = tz + 1 == tiles ? z1 : z0 + (z1 - z0) * (tz + 1) / tiles;
+			float tileMin = 0.0f, tileMax = 0.0f;
+			float amp = amplitude;
+			freq = frequency;
+			for (int i = 0; i < octaves; ++i) {
+				float low = -perlinRange, high = perlinRange;
+				if (!lattices[i].gradients.empty()) {
+					//Finer octaves have less amplitude and need less precision
+					auto [octaveLow, octaveHigh] = octaveRange(lattices[i], (tileX0 + 1) * freq, (tileZ0 + 1) * freq,
+						(tileX1 + 1) * freq, (tileZ1 + 1) * freq, std::max(1, subdivisions >> i));
+					low = std::max(low, octaveLow);
+					high = std::min(high, octaveHigh);
+				}
+				tileMin += amp * low;
+				tileMax += amp * high;
+				freq *= lacunarity;
+				amp *= gain;
+			}
+			minHeight = std::min(minHeight, tileMin);
+			maxHeight = std::max(maxHeight, tileMax);
+		}
+	}
+	return { std::max(minHeight, groundLevel), std::max(maxHeight, groundLevel) };
+}
+
+float TerrainNoise::interpolationError(float step)
+{
+	//Linear interpolation misses about curvature * (frequency * step)^2 of a smooth octave
+	float error = 0.0f;
+	float amp = amplitude;
+	float freq = frequency;
+	for (int i = 0; i < octaves; ++i) {
+		error += amp * std::min(octaveErrorCap, octaveCurvature * (freq * step) * (freq * step));
+		freq *= lacunarity;
+		amp *= gain;
+	}
+	return error;
+}
+
+TerrainNoise::Lattice TerrainNoise::makeLattice(float x0, float z0, float x1, float z1)
+{
+	Lattice lattice;
+	lattice.cellX0 = static_cast<int>(std::floor(x0));
+	lattice.cellZ0 = static_cast<int>(std::floor(z0));
+	lattice.width = static_cast<int>(std::floor(x1)) - lattice.cellX0 + 2;
+	lattice.depth = static_cast<int>(std::floor(z1)) - lattice.cellZ0 + 2;
+	int cellW = static_cast<int>(std::floor(seed));
+	lattice.gradients.reserve(lattice.width * lattice.depth * 2);
+	for (int c = 0; c < 2; ++c) {
+		for (int z = 0; z < lattice.depth; ++z) {
+			for (int x = 0; x < lattice.width; ++x) {
+				lattice.gradients.push_back(latticeGradient(lattice.cellX0 + x, lattice.cellZ0 + z, cellW + c));
+			}
+		}
+	}
+	return lattice;
+}
+
+std::pair<float, float> TerrainNoise::octaveRange(const Lattice& lattice, float x0, float z0, float x1, float z1, int boxesPerCell)
+{
+	//Cells outside the lattice can only be reached by float rounding of the box edges, the box is cut to the lattice
+	int cellX0 = std::max(static_cast<int>(std::floor(x0)), lattice.cellX0);
+	int cellX1 = std::min(static_cast<int>(std::floor(x1)), lattice.cellX0 + lattice.width - 2);
+	int cellZ0 = std::max(static_cast<int>(std::floor(z0)), lattice.cellZ0);
+	int cellZ1 = std::min(static_cast<int>(std::floor(z1)), lattice.cellZ0 + lattice.depth - 2);
+	float w = seed - std::floor(seed);
+
+	//Inside a cell the noise is a weighted average of the 8 corner functions g * (p - corner). Over a small box each weight
+	//and each corner function has a range, the noise is bounded by the best weights within those ranges that sum to 1
+	float fadeW = fade(w);
+	float low = perlinRange, high = -perlinRange;
+	for (int cz = cellZ0; cz <= cellZ1; ++cz) {
+		for (int cx = cellX0; cx <= cellX1; ++cx) {
+			float u0 = std::max(x0, static_cast<float>(cx)) - cx, u1 = std::min(x1, static_cast<float>(cx + 1)) - cx;
+			float v0 = std::max(z0, static_cast<float>(cz)) - cz, v1 = std::min(z1, static_cast<float>(cz + 1)) - cz;
+			int stepsU = std::max(1, static_cast<int>(std::ceil((u1 - u0) * boxesPerCell)));
+			int stepsV = std::max(1, static_cast<int>(std::ceil((v1 - v0) * boxesPerCell)));
+			for (int sv = 0; sv < stepsV; ++sv) {
+				for (int su = 0; su < stepsU; ++su) {
+					float boxU0 = u0 + (u1 - u0) * su / stepsU, boxU1 = u0 + (u1 - u0) * (su + 1) / stepsU;
+					float boxV0 = v0 + (v1 - v0) * sv / stepsV, boxV1 = v0 + (v1 - v0) * (sv + 1) / stepsV;
+					float fadeU0 = fade(boxU0), fadeU1 = fade(boxU1), fadeV0 = fade(boxV0), fadeV1 = fade(boxV1);
+
+					CornerRange corners[8];
+					for (int corner = 0; corner < 8; ++corner) {
+						int a = corner & 1, b = (corner >> 1) & 1, c = corner >> 2;
+						const glm::vec3& g = lattice.gradient(cx + a, cz + b, c);
+						//fade is increasing, so each weight factor is smallest at one end of the box
+						float weightW = c ? fadeW : 1.0f - fadeW;
+						corners[corner].minWeight = (a ? fadeU0 : 1.0f - fadeU1) * (b ? fadeV0 : 1.0f - fadeV1) * weightW;
+						corners[corner].maxWeight = (a ? fadeU1 : 1.0f - fadeU0) * (b ? fadeV1 : 1.0f - fadeV0) * weightW;
+						float constant = g.z * (w - c);
+						corners[corner].low = constant + g.x * ((g.x > 0.0f ? boxU0 : boxU1) - a) + g.y * ((g.y > 0.0f ? boxV0 : boxV1) - b);
+						corners[corner].high = constant + g.x * ((g.x > 0.0f ? boxU1 : boxU0) - a) + g.y * ((g.y > 0.0f ? boxV1 : boxV0) - b);
+					}
+					auto [boxLow, boxHigh] = blendRange(corners);
+					low = std::min(low, boxLow);
+					high = std::max(high, boxHigh);
+				}
+			}
+		}
+	}
+	return { low - gradientMargin, high + gradientMargin };
+}
+
+std::pair<float, float> TerrainNoise::blendRange(CornerRange* corners)
+{
+	//Every corner gets its smallest weight, the weight left to reach 1 goes to the corners with the largest (smallest) values first
+	float minWeightSum = 0.0f, low = 0.0f, high = 0.0f;
+	for (int i = 0; i < 8; ++i) {
+		minWeightSum += corners[i].minWeight;
+		low += corners[i].minWeight * corners[i].low;
+		high += corners[i].minWeight * corners[i].high;
+	}
+
+	std::sort(corners, corners + 8, [](const CornerRange& a, const CornerRange& b) { return a.high > b.high; });
+	float left = 1.0f - minWeightSum;
+	for (int i = 0; i < 8 && left > 0.0f; ++i) {
+		float weight = std::min(left, corners[i].maxWeight - corners[i].minWeight);
+		high += weight * corners[i].high;
+		left -= weight;
+	}
+
+	std::sort(corners, corners + 8, [](const CornerRange& a, const CornerRange& b) { return a.low < b.low; });
+	left = 1.0f - minWeightSum;
+	for (int i = 0; i < 8 && left > 0.0f; ++i) {
+		float weight = std::min(left, corners[i].maxWeight - corners[i].minWeight);
+		low += weight * corners[i].low;
+		left -= weight;
+	}
+	return { low, high };
+}
+
+glm::vec3 TerrainNoise::latticeGradient(int x, int z, int w)
+{
+	//A power of two step keeps the sample positions exact
+	constexpr float step = 1.0f / 256.0f;
+	glm::vec3 p{ static_cast<float>(x), static_cast<float>(z), static_cast<float>(w) };
+	glm::vec3 g;
+	for (int axis = 0; axis < 3; ++axis) {
+		glm::vec3 offset{ 0.0f };
+		offset[axis] = step;
+		g[axis] = (glm::perlin(p + offset) - glm::perlin(p - offset)) / (2.0f * step);
+	}
+	return g;
+}
@@ -0,0 +1,113 @@
+#include "..\header\WorkerPool.h"
+#include "..\header\HeapCounter.h"
+
+WorkerPool::WorkerPool(unsigned int nrWorkers)
+{
+	for (unsigned int i = 0; i < std::max(nrWorkers, 1u); ++i)
+		workers.emplace_back(&WorkerPool::run, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		stopping = true;
+	}
+	jobPushed.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void WorkerPool::push(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		jobs.push_back(std::move(job));
+	}
+	jobPushed.notify_one();
+}
+
+void WorkerPool::parallelFor(unsigned int count, void (*invoke)(const void* task, unsigned int i), const void* task)
+{
+	if (count == 0)
+		return;
+
+	TaskSet tasks;
+	tasks.invoke = invoke;
+	tasks.task = task;
+	tasks.count = count;
+	unsigned int helpers = std::min(count - 1, getWorkers());
+	tasks.helpers = helpers;
+	if (helpers > 0) {
+		{
+			std::lock_guard<std::mutex> lock(mu);
+			for (unsigned int i = 0; i < helpers; ++i)
+				helping.push_back(&tasks);
+		}
+		if (helpers == 1)
+			jobPushed.notify_one();
+		else
+			jobPushed.notify_all();
+	}
+
+	tasks.runTasks(false);
+
+	//Helpers that have not started are taken back, those that have may still be running a task
+	unsigned int unstarted = 0;
+	if (helpers > 0) {
+		std::lock_guard<std::mutex> lock(mu);
+		auto end = std::remove(helping.begin(), helping.end(), &tasks);
+		unstarted = static_cast<unsigned int>(helping.end() - end);
+		helping.erase(end, helping.end());
+	}
+	std::unique_lock<std::mutex> lock(tasks.mu);
+	tasks.helpers -= unstarted;
+	tasks.finished.wait(lock, [&] { return tasks.done == tasks.count && tasks.helpers == 0; });
+	HeapCounter::charge(tasks.heapAllocations);
+}
+
+void WorkerPool::TaskSet::runTasks(bool helper)
+{
+	unsigned int ran = 0;
+	size_t heapStart = HeapCounter::local();
+	for (unsigned int i = next++; i < count; i = next++) {
+		invoke(task, i);
+		++ran;
+	}
+
+	//Notified with the lock held, the set is gone as soon as the caller sees it finished
+	std::lock_guard<std::mutex> lock(mu);
+	done += ran;
+	if (helper) {
+		heapAllocations += HeapCounter::local() - heapStart;
+		--helpers;
+	}
+	if (done == count && helpers == 0)
+		finished.notify_all();
+}
+
+void WorkerPool::run()
+{
+	while (true) {
+		std::function<void()> job;
+		TaskSet* tasks = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mu);
+			jobPushed.wait(lock, [this] { return stopping || !helping.empty() || !jobs.empty(); });
+			if (stopping)
+				return;
+			if (!helping.empty()) {
+				tasks = helping.front();
+				helping.pop_front();
+			}
+			else {
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+		}
+		if (tasks)
+			tasks->runTasks(true);
+		else
+			job();
+	}
+}